@@ -0,0 +1,103 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+using namespace std;
+
+/*
+	Bump-pointer allocator for everything the parser creates for one program.
+	Objects are carved out of large chunks in allocation order, which for a
+	recursive descent parser puts children just before their parents. Nothing
+	is freed individually: destroying the arena runs the destructors that
+	matter and releases every chunk in one step.
+*/
+class Arena {
+private:
+	struct Finalizer {
+		void (*destroy)(void*);
+		void* object;
+	};
+
+	static const size_t CHUNK_SIZE = 64 * 1024;
+	vector<char*> chunks;
+	char* cursor = nullptr;
+	char* limit = nullptr;
+	vector<Finalizer> finalizers;
+
+public:
+	size_t allocations = 0;
+	size_t bytes = 0;
+
+	Arena() {}
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t size, size_t align) {
+		size_t padding = (align - (size_t)cursor % align) % align;
+		if (cursor == nullptr || padding + size > (size_t)(limit - cursor)) {
+			size_t chunkSize = size + align > CHUNK_SIZE ? size + align : CHUNK_SIZE;
+			char* chunk = (char*)malloc(chunkSize);
+			if (chunk == nullptr) {
+				cerr << "Error: out of memory allocating parse arena" << endl;
+				exit(1);
+			}
+			chunks.push_back(chunk);
+			cursor = chunk;
+			limit = chunk + chunkSize;
+			padding = (align - (size_t)cursor % align) % align;
+		}
+		void* result = cursor + padding;
+		cursor += padding + size;
+		allocations++;
+		bytes += size;
+		return result;
+	}
+
+	template <typename T, typename... Args>
+	T* make(Args&&... args) {
+		T* object = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+		if (!is_trivially_destructible<T>::value)
+			finalizers.push_back({ [](void* p) { ((T*)p)->~T(); }, object });
+		return object;
+	}
+
+	size_t chunkCount() const {
+		return chunks.size();
+	}
+
+	~Arena() {
+		for (size_t i = finalizers.size(); i > 0; i--)
+			finalizers[i - 1].destroy(finalizers[i - 1].object);
+		for (char* chunk : chunks)
+			free(chunk);
+	}
+};
+
+// Arena that parse-time allocations on this thread go to, or nullptr to fall
+// back to the global heap.
+thread_local Arena* currentArena = nullptr;
+
+// Makes arena the current arena for the lifetime of the scope.
+class ArenaScope {
+private:
+	Arena* previous;
+
+public:
+	ArenaScope(Arena* arena) : previous(currentArena) {
+		currentArena = arena;
+	}
+	~ArenaScope() {
+		currentArena = previous;
+	}
+};
+
+// Allocates a parse-time object in the current arena.
+template <typename T, typename... Args>
+T* arenaNew(Args&&... args) {
+	if (currentArena == nullptr)
+		return new T(forward<Args>(args)...);
+	return currentArena->make<T>(forward<Args>(args)...);
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Writes a main that makes ITERATIONS calls in a loop, either to a small
+# script function (add) or to the print builtin (print). Comparing two
+# iteration counts under the malloc counter gives the allocations per call.
+#
+# Usage: bench/gen_calls.sh add|print ITERATIONS > calls.pys
+case $1 in
+add)
+	cat <<END
+fun add(int a, int b) -> int {
+	return a + b
+}
+fun main() -> int {
+	int i = 0
+	while i < $2 {
+		i = add(i, 1)
+	}
+	return 0
+}
+END
+	;;
+print)
+	cat <<END
+fun main() -> int {
+	int i = 0
+	float f = 0.5
+	while i < $2 {
+		print(i, f)
+		i = i + 1
+	}
+	return 0
+}
+END
+	;;
+*)
+	echo "usage: $0 add|print ITERATIONS" >&2
+	exit 1
+	;;
+esac
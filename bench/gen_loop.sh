@@ -0,0 +1,19 @@
+#!/bin/sh
+# Writes a main that runs ITERATIONS iterations of an integer arithmetic
+# loop. Comparing two iteration counts separates the per-iteration cost
+# from the fixed start-up cost.
+#
+# Usage: bench/gen_loop.sh ITERATIONS > loop.pys
+cat <<END
+fun main() -> int {
+	int i
+	int sum
+	i = 0
+	sum = 0
+	while i < $1 {
+		i = i + 1
+		sum = sum + i * 3 - i / 2
+	}
+	return sum
+}
+END
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Writes a script whose main nests DEPTH while blocks, or DEPTH parentheses
+# around one literal, to stdout. Parse time should grow linearly with DEPTH.
+#
+# Usage: bench/gen_nested.sh blocks|parens DEPTH > nested.pys
+kind=$1
+depth=$2
+echo "fun main() -> int {"
+echo "	int x = 0"
+if [ "$kind" = blocks ]; then
+	i=0
+	while [ $i -lt "$depth" ]; do
+		echo "	while x < 1 {"
+		i=$((i + 1))
+	done
+	echo "	x = 1"
+	i=0
+	while [ $i -lt "$depth" ]; do
+		echo "	}"
+		i=$((i + 1))
+	done
+else
+	open=$(printf "%${depth}s" "" | tr " " "(")
+	close=$(printf "%${depth}s" "" | tr " " ")")
+	echo "	x = ${open}1${close}"
+fi
+echo "	return x"
+echo "}"
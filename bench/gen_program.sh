@@ -0,0 +1,41 @@
+#!/bin/sh
+# Writes a script with STRUCTS structs and FUNCTIONS small functions to
+# stdout, for measuring the front end and its heap allocations on a large
+# program. main calls none of the functions.
+#
+# Usage: bench/gen_program.sh STRUCTS FUNCTIONS > program.pys
+awk -v structs="$1" -v functions="$2" '
+# Identifiers cannot contain digits, so numbers are spelled with letters;
+# the two letter prefixes keep them clear of keywords.
+function name(prefix, n,    s) {
+	s = ""
+	do {
+		s = substr("abcdefghijklmnopqrstuvwxyz", n % 26 + 1, 1) s
+		n = int(n / 26)
+	} while (n > 0)
+	return prefix s
+}
+BEGIN {
+	for (i = 0; i < structs; i++) {
+		print "struct " name("St", i) " {"
+		print "\tint a"
+		print "\tfloat b"
+		print "\tint c"
+		print "}"
+	}
+	for (i = 0; i < functions; i++) {
+		print "fun " name("fn", i) "(" name("St", i % structs) " s, int n) -> int {"
+		print "\tint total = s.a + n * 2"
+		print "\twhile total < 100 {"
+		print "\t\ttotal = total + (s.c + 3)"
+		print "\t}"
+		print "\tif total > 50 {"
+		print "\t\treturn total - 1"
+		print "\t}"
+		print "\treturn total"
+		print "}"
+	}
+	print "fun main() -> int {"
+	print "\treturn 0"
+	print "}"
+}'
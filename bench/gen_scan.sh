@@ -0,0 +1,42 @@
+#!/bin/sh
+# Writes LINES lines for --lex-only in which one character class dominates,
+# to measure a single scan kernel:
+#   identifiers  short names, as in typical code
+#   whitespace   names separated by long runs of spaces and tabs
+#   numbers      long int and float literals
+#   strings      string literals of 20 to 60 characters
+# The output is not a valid program.
+#
+# Usage: bench/gen_scan.sh identifiers|whitespace|numbers|strings LINES > scan.pys
+awk -v kind="$1" -v lines="$2" 'BEGIN {
+	split("ix elem count sum result acc total buffer", names, " ")
+	srand(1)
+	for (i = 0; i < lines; i++) {
+		line = ""
+		for (j = 0; j < 8; j++) {
+			if (kind == "identifiers") {
+				line = line " " names[int(rand() * 8) + 1]
+			}
+			else if (kind == "whitespace") {
+				gap = ""
+				for (n = int(rand() * 40) + 8; n > 0; n--)
+					gap = gap (rand() < 0.8 ? " " : "\t")
+				line = line gap names[int(rand() * 8) + 1]
+			}
+			else if (kind == "numbers") {
+				line = line " " int(rand() * 1000000000) (rand() < 0.5 ? "." int(rand() * 1000000) : "")
+			}
+			else if (kind == "strings") {
+				text = ""
+				for (n = int(rand() * 40) + 20; n > 0; n--)
+					text = text substr("abcdefghij klmnopqrst uvwxyz", int(rand() * 29) + 1, 1)
+				line = line " \"" text "\""
+			}
+			else {
+				print "usage: gen_scan.sh identifiers|whitespace|numbers|strings LINES" > "/dev/stderr"
+				exit 1
+			}
+		}
+		print substr(line, 2)
+	}
+}'
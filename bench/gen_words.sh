@@ -0,0 +1,22 @@
+#!/bin/sh
+# Writes WORDS words, eight to a line, of which KEYWORD_PERCENT percent are
+# keywords and the rest identifiers. The identifiers have the same lengths
+# as the keywords, so only keyword density changes between runs. The output
+# is for --lex-only and is not a valid program.
+#
+# Usage: bench/gen_words.sh KEYWORD_PERCENT WORDS > words.pys
+awk -v percent="$1" -v words="$2" 'BEGIN {
+	split("if else while for return fun class struct", keywords, " ")
+	split("ix elem count sum result acc total buffer", names, " ")
+	srand(1)
+	for (i = 0; i < words; i++) {
+		k = int(rand() * 8) + 1
+		line = line (i % 8 ? " " : "") (rand() * 100 < percent ? keywords[k] : names[k])
+		if (i % 8 == 7) {
+			print line
+			line = ""
+		}
+	}
+	if (line != "")
+		print line
+}'
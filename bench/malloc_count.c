@@ -0,0 +1,26 @@
+/*
+	Counts the heap allocations of a process and prints the total to stderr
+	as "mallocs: N" when it exits. operator new allocates through malloc, so
+	C++ allocations are counted as well.
+
+	Build: cc -O2 -shared -fPIC -o malloc_count.so bench/malloc_count.c -ldl
+	Use:   MALLOC_COUNT=$PWD/malloc_count.so bench/run.sh ./pys script.pys
+*/
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned long mallocs = 0;
+static void* (*realMalloc)(size_t) = NULL;
+
+void* malloc(size_t size) {
+	if (realMalloc == NULL)
+		realMalloc = (void* (*)(size_t))dlsym(RTLD_NEXT, "malloc");
+	mallocs++;
+	return realMalloc(size);
+}
+
+__attribute__((destructor)) static void report(void) {
+	fprintf(stderr, "mallocs: %lu\n", mallocs);
+}
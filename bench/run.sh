@@ -0,0 +1,21 @@
+#!/bin/sh
+# Runs a benchmark script and prints the front end and run times that
+# --stats reports. The interpreter reads expressions.pys from its working
+# directory, so the script is copied into a scratch directory first.
+# Set MALLOC_COUNT to a build of malloc_count.c to also print the number
+# of heap allocations the interpreter made.
+#
+# Usage: bench/run.sh path/to/interpreter script.pys [interpreter flags...]
+set -e
+interpreter=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+script=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+shift 2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cp "$script" "$dir/expressions.pys"
+cd "$dir"
+if [ -n "$MALLOC_COUNT" ]; then
+	LD_PRELOAD="$MALLOC_COUNT" "$interpreter" --no-cache --stats "$@" 2>&1 >/dev/null | grep -E "^(front end|run|lexer|mallocs):|Error" || true
+else
+	"$interpreter" --no-cache --stats "$@" 2>&1 >/dev/null | grep -E "^(front end|run|lexer):|Error" || true
+fi
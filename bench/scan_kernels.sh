@@ -0,0 +1,26 @@
+#!/bin/sh
+# Prints the lexer throughput of every scan kernel set on inputs dominated
+# by identifiers, whitespace, numbers and strings (see gen_scan.sh). Sets
+# this CPU cannot run are skipped.
+#
+# Usage: bench/scan_kernels.sh path/to/interpreter [LINES]
+set -e
+bench=$(cd "$(dirname "$0")" && pwd)
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+printf "%-12s" "input"
+for kernels in auto scalar sse2 avx2; do
+	printf "%10s" "$kernels"
+done
+echo
+for kind in identifiers whitespace numbers strings; do
+	"$bench/gen_scan.sh" "$kind" "${2:-100000}" > "$dir/$kind.pys"
+	printf "%-12s" "$kind"
+	for kernels in auto scalar sse2 avx2; do
+		rate=$("$bench/run.sh" "$1" "$dir/$kind.pys" --lex-only --scan-kernels=$kernels |
+			sed -n 's/^lexer:.*(\([0-9.]*\) MB\/s)$/\1/p')
+		printf "%10s" "${rate:+$(printf "%.0f" "$rate")}"
+	done
+	echo
+done
+echo "(MB/s)"
@@ -0,0 +1,528 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include "util.hpp"
+#include "symbols.hpp"
+#include "arena.hpp"
+#include "parser.hpp"
+using namespace std;
+
+/*
+	Compiled-program cache. After a cold compile the parsed Program is written
+	next to the script as <script>.cache, keyed by a hash of the source text.
+	Later runs map the cache and rebuild the Program from it without lexing or
+	parsing.
+
+	Layout (host byte order, the cache is not meant to move between machines):
+	- header: magic "PYSC", format version, source hash
+	- symbol table: every interned name, in symbol order
+	- struct table: name, type id and fields of each struct
+	- function table: name, parameters, return type and body of each function
+	Nodes are written in pre-order as their ASTNodeType followed by their
+	fields. Return and ReturnBlock share RETURN_BLOCK, but only Return ever
+	comes out of the parser.
+*/
+
+const char CACHE_MAGIC[4] = { 'P', 'Y', 'S', 'C' };
+const uint32_t CACHE_VERSION = 4;
+const uint8_t CACHE_NULL_NODE = 0xFF;
+
+// FNV-1a over the whole source.
+uint64_t hashSource(string_view source) {
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : source) {
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+string cachePathFor(string scriptPath) {
+	return scriptPath + ".cache";
+}
+
+class CacheWriter {
+public:
+	string bytes;
+
+	void u8(uint8_t value) {
+		bytes.push_back((char)value);
+	}
+
+	void u32(uint32_t value) {
+		bytes.append((const char*)&value, sizeof(value));
+	}
+
+	void u64(uint64_t value) {
+		bytes.append((const char*)&value, sizeof(value));
+	}
+
+	void f32(float value) {
+		bytes.append((const char*)&value, sizeof(value));
+	}
+
+	void str(const string& value) {
+		u32(value.size());
+		bytes.append(value);
+	}
+
+	void memberList(const MemberList& list) {
+		u32(list.members.size());
+		for (Symbol member : list.members)
+			u32(member);
+		u32(list.slot);
+		u32((uint32_t)list.rootType);
+		u32(list.slots.size());
+		for (int slot : list.slots)
+			u32(slot);
+	}
+
+	void data(Data data) {
+		u32((uint32_t)data.type);
+		switch (data.type) {
+		case INT: u32(data.intValue); break;
+		case FLOAT: f32(data.floatValue); break;
+		case BOOL: u8(data.boolValue); break;
+		case STR: str(((StringObject*)data.data)->value); break;
+		default:
+			cerr << "Error: cannot cache a literal of type " << data.type << endl;
+			exit(1);
+		}
+	}
+
+	void statement(Statement* statement);
+
+	void expression(Expression* expression) {
+		if (expression == nullptr) {
+			u8(CACHE_NULL_NODE);
+			return;
+		}
+		u8(expression->type);
+		switch (expression->type) {
+		case OPERATOR: {
+			Operator* op = (Operator*)expression;
+			str(op->op);
+			this->expression(op->left);
+			this->expression(op->right);
+			break;
+		}
+		case LITERAL:
+			data(((Literal*)expression)->data);
+			break;
+		case VARIABLE:
+			memberList(((Variable*)expression)->members);
+			break;
+		case FUNCTION_CALL: {
+			FunctionCall* call = (FunctionCall*)expression;
+			u32(call->functionName);
+			u32(call->params.size());
+			for (Expression* param : call->params)
+				this->expression(param);
+			break;
+		}
+		case RETURN_BLOCK:
+			this->expression(((Return*)expression)->expression);
+			break;
+		case STATEMENT_WRAPPER:
+			statement(((StatementWrapper*)expression)->statement);
+			break;
+		default:
+			cerr << "Error: cannot cache expression node " << expression->type << endl;
+			exit(1);
+		}
+	}
+};
+
+void CacheWriter::statement(Statement* statement) {
+	if (statement == nullptr) {
+		u8(CACHE_NULL_NODE);
+		return;
+	}
+	u8(statement->type);
+	switch (statement->type) {
+	case BLOCK: {
+		Block* block = (Block*)statement;
+		u32(block->statements.size());
+		for (Statement* child : block->statements)
+			this->statement(child);
+		break;
+	}
+	case ASSIGNMENT: {
+		Assignment* assignment = (Assignment*)statement;
+		memberList(assignment->identifier);
+		expression(assignment->expression);
+		break;
+	}
+	case DECLARATION: {
+		Declaration* decleration = (Declaration*)statement;
+		u32(decleration->identifier);
+		u32((uint32_t)decleration->type);
+		u32(decleration->slot);
+		break;
+	}
+	case IF_STATEMENT: {
+		IfStatement* ifStatement = (IfStatement*)statement;
+		expression(ifStatement->condition);
+		this->statement(ifStatement->ifBlock);
+		this->statement(ifStatement->elseBlock);
+		break;
+	}
+	case WHILE_STATEMENT: {
+		WhileStatement* whileStatement = (WhileStatement*)statement;
+		expression(whileStatement->condition);
+		this->statement(whileStatement->block);
+		break;
+	}
+	case EXPR_WRAPPER:
+		expression(((ExpressionWrapper*)statement)->expression);
+		break;
+	default:
+		cerr << "Error: cannot cache statement node " << statement->type << endl;
+		exit(1);
+	}
+}
+
+// Reads a cache image. Any malformed input sets failed and yields empty
+// values, so a corrupt or truncated cache is treated as a miss.
+class CacheReader {
+private:
+	const char* cursor;
+	const char* end;
+	// Symbols and struct type ids as they were when the cache was written,
+	// mapped to the ones this run assigned.
+	vector<Symbol> symbolMap;
+	map<int, DataType> typeMap;
+
+	bool take(void* out, size_t size) {
+		if (failed || (size_t)(end - cursor) < size) {
+			failed = true;
+			memset(out, 0, size);
+			return false;
+		}
+		memcpy(out, cursor, size);
+		cursor += size;
+		return true;
+	}
+
+public:
+	bool failed = false;
+
+	CacheReader(string_view bytes) : cursor(bytes.data()), end(bytes.data() + bytes.size()) {}
+
+	uint8_t u8() {
+		uint8_t value;
+		take(&value, sizeof(value));
+		return value;
+	}
+
+	uint32_t u32() {
+		uint32_t value;
+		take(&value, sizeof(value));
+		return value;
+	}
+
+	uint64_t u64() {
+		uint64_t value;
+		take(&value, sizeof(value));
+		return value;
+	}
+
+	float f32() {
+		float value;
+		take(&value, sizeof(value));
+		return value;
+	}
+
+	string str() {
+		uint32_t size = u32();
+		if (failed || (size_t)(end - cursor) < size) {
+			failed = true;
+			return "";
+		}
+		string value(cursor, size);
+		cursor += size;
+		return value;
+	}
+
+	void readSymbolTable() {
+		uint32_t count = u32();
+		for (uint32_t i = 0; i < count && !failed; i++)
+			symbolMap.push_back(symbols.intern(str()));
+	}
+
+	Symbol symbol() {
+		uint32_t symbol = u32();
+		if (symbol >= symbolMap.size()) {
+			failed = true;
+			return NO_SYMBOL;
+		}
+		return symbolMap[symbol];
+	}
+
+	void mapType(int cached, DataType current) {
+		typeMap[cached] = current;
+	}
+
+	DataType type() {
+		int cached = (int)u32();
+		if (cached >= NULL_TYPE && cached <= LIST)
+			return (DataType)cached;
+		auto it = typeMap.find(cached);
+		if (it == typeMap.end()) {
+			failed = true;
+			return NULL_TYPE;
+		}
+		return it->second;
+	}
+
+	MemberList memberList() {
+		vector<Symbol> members;
+		uint32_t count = u32();
+		for (uint32_t i = 0; i < count && !failed; i++)
+			members.push_back(symbol());
+		MemberList list(members);
+		list.slot = (int)u32();
+		list.rootType = type();
+		uint32_t slotCount = u32();
+		for (uint32_t i = 0; i < slotCount && !failed; i++)
+			list.slots.push_back((int)u32());
+		return list;
+	}
+
+	Data data() {
+		DataType type = this->type();
+		switch (type) {
+		case INT: return makeInt((int)u32());
+		case FLOAT: return makeFloat(f32());
+		case BOOL: return makeBool(u8() != 0);
+		case STR: return Data(STR, heap.allocatePinned<StringObject>(str()));
+		default:
+			failed = true;
+			return Data();
+		}
+	}
+
+	Statement* statement();
+
+	Expression* expression() {
+		uint8_t tag = u8();
+		if (failed || tag == CACHE_NULL_NODE)
+			return nullptr;
+		switch (tag) {
+		case OPERATOR: {
+			string op = str();
+			Expression* left = expression();
+			Expression* right = expression();
+			return arenaNew<Operator>(op, left, right);
+		}
+		case LITERAL:
+			return arenaNew<Literal>(data());
+		case VARIABLE:
+			return arenaNew<Variable>(memberList());
+		case FUNCTION_CALL: {
+			Symbol name = symbol();
+			uint32_t count = u32();
+			vector<Expression*> params;
+			for (uint32_t i = 0; i < count && !failed; i++)
+				params.push_back(expression());
+			return arenaNew<FunctionCall>(name, params);
+		}
+		case RETURN_BLOCK:
+			return arenaNew<Return>(expression());
+		case STATEMENT_WRAPPER:
+			return arenaNew<StatementWrapper>(statement());
+		}
+		failed = true;
+		return nullptr;
+	}
+
+	Block* block() {
+		Statement* statement = this->statement();
+		if (statement != nullptr && statement->type != BLOCK)
+			failed = true;
+		return failed ? nullptr : (Block*)statement;
+	}
+};
+
+Statement* CacheReader::statement() {
+	uint8_t tag = u8();
+	if (failed || tag == CACHE_NULL_NODE)
+		return nullptr;
+	switch (tag) {
+	case BLOCK: {
+		Block* block = arenaNew<Block>();
+		uint32_t count = u32();
+		for (uint32_t i = 0; i < count && !failed; i++)
+			block->statements.push_back(statement());
+		return block;
+	}
+	case ASSIGNMENT: {
+		MemberList identifier = memberList();
+		Expression* expression = this->expression();
+		return arenaNew<Assignment>(identifier, expression);
+	}
+	case DECLARATION: {
+		Symbol identifier = symbol();
+		DataType type = this->type();
+		int slot = (int)u32();
+		return arenaNew<Declaration>(identifier, type, slot);
+	}
+	case IF_STATEMENT: {
+		Expression* condition = expression();
+		Block* ifBlock = block();
+		Block* elseBlock = block();
+		return arenaNew<IfStatement>(condition, ifBlock, elseBlock);
+	}
+	case WHILE_STATEMENT: {
+		Expression* condition = expression();
+		Block* body = block();
+		return arenaNew<WhileStatement>(condition, body);
+	}
+	case EXPR_WRAPPER:
+		return arenaNew<ExpressionWrapper>(expression());
+	}
+	failed = true;
+	return nullptr;
+}
+
+// Writes program to path. Bodies whose parse was deferred are parsed first,
+// since the cache only holds complete ASTs.
+void writeProgramCache(Program* program, string path, uint64_t sourceHash) {
+	CacheWriter w;
+	w.bytes.append(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	w.u32(CACHE_VERSION);
+	w.u64(sourceHash);
+
+	w.u32(symbols.size());
+	for (size_t i = 0; i < symbols.size(); i++)
+		w.str(symbols.name((Symbol)i));
+
+	w.u32(program->structs.size());
+	for (StructDecleration* decleration : program->structs) {
+		w.u32(decleration->name);
+		w.u32((uint32_t)types.get(decleration->name));
+	}
+	for (StructDecleration* decleration : program->structs) {
+		w.u32(decleration->fields.size());
+		for (pair<Symbol, DataType> field : decleration->fields) {
+			w.u32(field.first);
+			w.u32((uint32_t)field.second);
+		}
+	}
+
+	w.u32(program->functions.size());
+	for (FunctionDecleration* function : program->functions) {
+		if (function->block == nullptr) {
+			ArenaScope scope(function->arena);
+			bool trace = traceParser;
+			traceParser = false;
+			function->block = parseFunctionBody(function->body, function->list, function->frameSize);
+			traceParser = trace;
+		}
+		w.u32(function->name);
+		w.u32(function->list.params.size());
+		for (pair<Symbol, DataType> param : function->list.params) {
+			w.u32(param.first);
+			w.u32((uint32_t)param.second);
+		}
+		w.u32((uint32_t)function->returnType);
+		w.u32(function->frameSize);
+		w.statement(function->block);
+	}
+
+	// Write to a temporary file first so a crash never leaves a torn cache.
+	string temporary = path + ".tmp";
+	ofstream file(temporary, ios::binary | ios::trunc);
+	if (!file.is_open()) {
+		cerr << "Warning: could not write program cache " << path << endl;
+		return;
+	}
+	file.write(w.bytes.data(), w.bytes.size());
+	file.close();
+	if (!file || rename(temporary.c_str(), path.c_str()) != 0) {
+		cerr << "Warning: could not write program cache " << path << endl;
+		remove(temporary.c_str());
+	}
+}
+
+// Returns the cached program for a source with sourceHash, or nullptr when
+// there is no usable cache. Must run before anything else registers struct
+// types, since it registers the cached ones itself.
+Program* loadProgramCache(string path, uint64_t sourceHash) {
+	SourceFile* file = mapSourceFile(path, false);
+	CacheReader r(file->view());
+	char magic[4] = {};
+	for (char& c : magic)
+		c = (char)r.u8();
+	if (r.failed || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 || r.u32() != CACHE_VERSION || r.u64() != sourceHash) {
+		delete file;
+		return nullptr;
+	}
+	r.readSymbolTable();
+
+	Program* program = new Program();
+	ArenaScope scope(program->arenas[0]);
+	int firstStructType = nextDataType;
+
+	// Register every struct before reading field types, which may refer to
+	// structs declared later.
+	uint32_t structCount = r.u32();
+	vector<Symbol> structNames;
+	for (uint32_t i = 0; i < structCount && !r.failed; i++) {
+		Symbol name = r.symbol();
+		int cachedType = (int)r.u32();
+		if (r.failed)
+			break;
+		addDataType(name);
+		r.mapType(cachedType, types.get(name));
+		structNames.push_back(name);
+	}
+	for (Symbol name : structNames) {
+		map<Symbol, DataType> fields;
+		uint32_t fieldCount = r.u32();
+		for (uint32_t k = 0; k < fieldCount && !r.failed; k++) {
+			Symbol field = r.symbol();
+			fields[field] = r.type();
+		}
+		StructDecleration* decleration = arenaNew<StructDecleration>(name, fields);
+		decleration->execute();
+		program->structs.push_back(decleration);
+	}
+
+	uint32_t functionCount = r.u32();
+	for (uint32_t i = 0; i < functionCount && !r.failed; i++) {
+		Symbol name = r.symbol();
+		vector<pair<Symbol, DataType>> params;
+		uint32_t paramCount = r.u32();
+		for (uint32_t k = 0; k < paramCount && !r.failed; k++) {
+			Symbol param = r.symbol();
+			params.push_back({ param, r.type() });
+		}
+		DataType returnType = r.type();
+		int frameSize = (int)r.u32();
+		Block* block = r.block();
+		if (block == nullptr)
+			r.failed = true;
+		program->functions.push_back(arenaNew<FunctionDecleration>(name, block, frameSize, string_view(), ParameterList(params), returnType));
+	}
+	delete file;
+	if (r.failed) {
+		cerr << "Warning: ignoring unreadable program cache " << path << endl;
+		for (Symbol name : structNames) {
+			structs.erase(types.get(name));
+			setDataType(name, NULL_TYPE);
+		}
+		nextDataType = firstStructType;
+		delete program;
+		return nullptr;
+	}
+	stats.functionsDeclared += program->functions.size();
+	stats.functionsParsed += program->functions.size();
+	return program;
+}
@@ -0,0 +1,324 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include "parser.hpp"
+using namespace std;
+
+/*
+	Closure engine, selected with --engine=closure. Each function body is
+	turned once into a tree of C++ closures that capture what the AST node
+	would otherwise look up on every run: child closures, frame and field
+	slots, operator kinds and call targets. Running a body is then a chain of
+	indirect calls with no dispatch on node types.
+
+	A statement closure returns true once a return statement has run, with the
+	returned value in result, which stops the enclosing blocks and loops.
+*/
+
+typedef function<Data()> ExpressionClosure;
+typedef function<bool(Data& result)> StatementClosure;
+
+class ClosureFunction : public Callable {
+private:
+	Function* function;
+	StatementClosure body;
+	bool compiled = false;
+
+	void compile();
+
+public:
+	ClosureFunction(Function* function) : function(function) {}
+
+	// Runs the function on a frame whose first slots, starting at base, already
+	// hold the arguments, then pops the frame.
+	Data invoke(size_t base) {
+		if (!compiled)
+			compile();
+		valueStack.resize(base + function->frameSize);
+		size_t callerBase = frameBase;
+		frameBase = base;
+		Data result;
+		body(result);
+		frameBase = callerBase;
+		valueStack.resize(base);
+		return result;
+	}
+
+	void call(DataSpan args, Data& result) {
+		size_t base = valueStack.size();
+		valueStack.insert(valueStack.end(), args.begin(), args.end());
+		result = invoke(base);
+	}
+
+	int arity() override {
+		return function->arity();
+	}
+
+	Function* definition() override {
+		return function;
+	}
+};
+
+StatementClosure compileStatementClosure(Statement* statement);
+
+// Int operands take the inline path; anything else goes through
+// applyOperator, which handles the other types and reports type errors.
+template <OperatorKind K>
+ExpressionClosure compileOperatorClosure(ExpressionClosure left, ExpressionClosure right) {
+	return [left, right]() {
+		Data leftData = left();
+		Data rightData = right();
+		if (leftData.type == INT && rightData.type == INT) {
+			int x = leftData.intValue;
+			int y = rightData.intValue;
+			switch (K) {
+			case OP_ADD: return makeInt(x + y);
+			case OP_SUBTRACT: return makeInt(x - y);
+			case OP_MULTIPLY: return makeInt(x * y);
+			case OP_DIVIDE: return makeInt(x / y);
+			case OP_GREATER: return makeBool(x > y);
+			case OP_LESS: return makeBool(x < y);
+			case OP_EQUAL: return makeBool(x == y);
+			case OP_NOT_EQUAL: return makeBool(x != y);
+			default: break;
+			}
+		}
+		return applyOperator(K, operatorSpellings[K], leftData, rightData);
+	};
+}
+
+ExpressionClosure compileExpressionClosure(Expression* expression) {
+	switch (expression->type) {
+	case LITERAL: {
+		Data data = ((Literal*)expression)->data;
+		return [data]() { return data; };
+	}
+	case VARIABLE: {
+		MemberList* members = &((Variable*)expression)->members;
+		if (members->members.size() == 1) {
+			size_t slot = members->slot;
+			return [slot]() { return valueStack[frameBase + slot]; };
+		}
+		return [members]() { return *members->get(); };
+	}
+	case OPERATOR: {
+		Operator* op = (Operator*)expression;
+		ExpressionClosure left = compileExpressionClosure(op->left);
+		ExpressionClosure right = compileExpressionClosure(op->right);
+		switch (op->kind) {
+		case OP_ADD: return compileOperatorClosure<OP_ADD>(left, right);
+		case OP_SUBTRACT: return compileOperatorClosure<OP_SUBTRACT>(left, right);
+		case OP_MULTIPLY: return compileOperatorClosure<OP_MULTIPLY>(left, right);
+		case OP_DIVIDE: return compileOperatorClosure<OP_DIVIDE>(left, right);
+		case OP_GREATER: return compileOperatorClosure<OP_GREATER>(left, right);
+		case OP_LESS: return compileOperatorClosure<OP_LESS>(left, right);
+		case OP_EQUAL: return compileOperatorClosure<OP_EQUAL>(left, right);
+		case OP_NOT_EQUAL: return compileOperatorClosure<OP_NOT_EQUAL>(left, right);
+		case OP_AND: return compileOperatorClosure<OP_AND>(left, right);
+		case OP_OR: return compileOperatorClosure<OP_OR>(left, right);
+		default: {
+			string spelling = op->op;
+			return [left, right, spelling]() {
+				Data leftData = left();
+				Data rightData = right();
+				return applyOperator(OP_UNKNOWN, spelling, leftData, rightData);
+			};
+		}
+		}
+	}
+	case FUNCTION_CALL: {
+		FunctionCall* call = (FunctionCall*)expression;
+		vector<ExpressionClosure> params;
+		for (Expression* param : call->params)
+			params.push_back(compileExpressionClosure(param));
+		// Script functions were replaced by their closure versions before any
+		// body is compiled, so the name now leads to the ClosureFunction.
+		Callable* callee = functions.get(call->functionName);
+		ClosureFunction* target = dynamic_cast<ClosureFunction*>(callee);
+		if (target != nullptr && call->checkedParams != nullptr) {
+			return [target, params, call]() {
+				size_t base = valueStack.size();
+				for (const ExpressionClosure& param : params) {
+					Data value = param();
+					valueStack.push_back(value);
+				}
+				call->checkArguments(DataSpan(valueStack.data() + base, params.size()));
+				return target->invoke(base);
+			};
+		}
+		if (target != nullptr) {
+			// Arguments are pushed where the callee's frame will start, so they
+			// are its parameters without a copy.
+			return [target, params]() {
+				size_t base = valueStack.size();
+				for (const ExpressionClosure& param : params) {
+					Data value = param();
+					valueStack.push_back(value);
+				}
+				return target->invoke(base);
+			};
+		}
+		return [callee, params, call]() {
+			size_t base = evaluationStack.size();
+			for (const ExpressionClosure& param : params)
+				evaluationStack.push_back(param());
+			if (call->checkedParams != nullptr)
+				call->checkArguments(DataSpan(evaluationStack.data() + base, params.size()));
+			Data result;
+			callee->call(DataSpan(evaluationStack.data() + base, params.size()), result);
+			evaluationStack.resize(base);
+			return result;
+		};
+	}
+	case STATEMENT_WRAPPER: {
+		StatementClosure statement = compileStatementClosure(((StatementWrapper*)expression)->statement);
+		return [statement]() {
+			Data ignored;
+			statement(ignored);
+			return Data();
+		};
+	}
+	default:
+		cerr << "Error: cannot compile expression node " << expression->type << " to a closure" << endl;
+		exit(1);
+	}
+}
+
+// Compiles an expression that stands as a statement. Only a return stops
+// execution.
+StatementClosure compileEffectClosure(Expression* expression) {
+	if (expression->type == RETURN_BLOCK) {
+		ExpressionClosure value = compileExpressionClosure(((Return*)expression)->expression);
+		return [value](Data& result) {
+			result = value();
+			return true;
+		};
+	}
+	if (expression->type == STATEMENT_WRAPPER)
+		return compileStatementClosure(((StatementWrapper*)expression)->statement);
+	ExpressionClosure value = compileExpressionClosure(expression);
+	return [value](Data&) {
+		value();
+		return false;
+	};
+}
+
+StatementClosure compileBlockClosure(vector<StatementClosure> statements) {
+	return [statements](Data& result) {
+		for (const StatementClosure& statement : statements) {
+			if (statement(result))
+				return true;
+		}
+		return false;
+	};
+}
+
+StatementClosure compileStatementClosure(Statement* statement) {
+	switch (statement->type) {
+	case BLOCK: {
+		vector<StatementClosure> statements;
+		for (Statement* child : ((Block*)statement)->statements)
+			statements.push_back(compileStatementClosure(child));
+		return compileBlockClosure(statements);
+	}
+	case ASSIGNMENT: {
+		Assignment* assignment = (Assignment*)statement;
+		ExpressionClosure value = compileExpressionClosure(assignment->expression);
+		MemberList* identifier = &assignment->identifier;
+		if (identifier->members.size() == 1) {
+			size_t slot = identifier->slot;
+			return [value, slot](Data&) {
+				Data data = value();
+				Data& cell = valueStack[frameBase + slot];
+				if (cell.type != data.type) {
+					cerr << "Assignment::Execute Error: expected type " << cell.type << " but got " << data.type << endl;
+					exit(1);
+				}
+				cell = data;
+				return false;
+			};
+		}
+		return [value, identifier](Data&) {
+			Data data = value();
+			Data* cell = identifier->get();
+			if (cell->type != data.type) {
+				cerr << "Assignment::Execute Error: expected type " << cell->type << " but got " << data.type << endl;
+				exit(1);
+			}
+			*cell = data;
+			return false;
+		};
+	}
+	case DECLARATION: {
+		Declaration* decleration = (Declaration*)statement;
+		size_t slot = decleration->slot;
+		DataType type = decleration->type;
+		return [slot, type](Data&) {
+			Data data = createDataFromType(type);
+			valueStack[frameBase + slot] = data;
+			return false;
+		};
+	}
+	case IF_STATEMENT: {
+		IfStatement* ifStatement = (IfStatement*)statement;
+		ExpressionClosure condition = compileExpressionClosure(ifStatement->condition);
+		StatementClosure ifBlock = compileStatementClosure(ifStatement->ifBlock);
+		StatementClosure elseBlock = ifStatement->elseBlock != nullptr ? compileStatementClosure(ifStatement->elseBlock) : nullptr;
+		return [condition, ifBlock, elseBlock](Data& result) {
+			Data conditionData = condition();
+			if (conditionData.type != BOOL) {
+				cerr << "Error: expected bool in if statement condition but got " << conditionData.type << endl;
+				exit(1);
+			}
+			if (conditionData.boolValue)
+				return ifBlock(result);
+			return elseBlock != nullptr && elseBlock(result);
+		};
+	}
+	case WHILE_STATEMENT: {
+		WhileStatement* whileStatement = (WhileStatement*)statement;
+		ExpressionClosure condition = compileExpressionClosure(whileStatement->condition);
+		StatementClosure block = compileStatementClosure(whileStatement->block);
+		return [condition, block](Data& result) {
+			for (;;) {
+				Data conditionData = condition();
+				if (conditionData.type != BOOL) {
+					cerr << "Error: expected bool in while statement condition but got " << conditionData.type << endl;
+					exit(1);
+				}
+				if (!conditionData.boolValue)
+					return false;
+				if (block(result))
+					return true;
+			}
+		};
+	}
+	case EXPR_WRAPPER:
+		return compileEffectClosure(((ExpressionWrapper*)statement)->expression);
+	default:
+		cerr << "Error: cannot compile statement node " << statement->type << " to a closure" << endl;
+		exit(1);
+	}
+}
+
+void ClosureFunction::compile() {
+	if (function->block == nullptr)
+		function->parseBody();
+	vector<StatementClosure> statements;
+	for (Expression* expression : function->block->expressions)
+		statements.push_back(compileEffectClosure(expression));
+	body = compileBlockClosure(statements);
+	compiled = true;
+}
+
+// Puts a ClosureFunction in front of every script function, so calls by name,
+// including main's, run on the closure engine. Bodies compile on first call.
+void installClosureEngine() {
+	for (Symbol name = 0; name < functions.size(); name++) {
+		Function* function = dynamic_cast<Function*>(functions.get(name));
+		if (function != nullptr)
+			functions[name] = new ClosureFunction(function);
+	}
+}
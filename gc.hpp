@@ -0,0 +1,128 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "stats.hpp"
+using namespace std;
+
+/*
+	Managed heap for runtime values that do not fit inline in a Data: strings,
+	lists and struct instances. Every object is linked into the heap when it is
+	allocated and reclaimed by a stop-the-world mark and sweep.
+	- mark: markRoots marks what the interpreter can reach directly (the
+	  variable environment and the evaluation stack), then each grey object
+	  traces its children until nothing is left to visit
+	- sweep: unmarked objects are deleted, marked ones are cleared for the
+	  next collection
+	A collection runs before an allocation once the bytes allocated since the
+	last one reach the current threshold. The threshold then becomes the live
+	size times growth, but never less than minThreshold.
+*/
+class GCObject {
+public:
+	GCObject* next = nullptr;
+	size_t size = 0;
+	bool marked = false;
+	// Pinned objects are owned by the program and never swept.
+	bool pinned = false;
+	virtual ~GCObject() {}
+	// Marks every object this one refers to.
+	virtual void trace() {}
+};
+
+class Heap {
+private:
+	GCObject* objects = nullptr;
+	vector<GCObject*> grey;
+	size_t allocatedSinceCollection = 0;
+	size_t nextCollection = 1024 * 1024;
+
+	void link(GCObject* object, size_t size) {
+		object->size = size;
+		object->next = objects;
+		objects = object;
+		liveBytes += size;
+		allocatedSinceCollection += size;
+	}
+
+public:
+	size_t minThreshold = 1024 * 1024;
+	double growth = 2.0;
+	size_t liveBytes = 0;
+	void (*markRoots)() = nullptr;
+
+	void setThreshold(size_t bytes) {
+		minThreshold = bytes;
+		nextCollection = bytes;
+	}
+
+	template <typename T, typename... Args>
+	T* allocate(Args&&... args) {
+		if (allocatedSinceCollection >= nextCollection)
+			collect();
+		T* object = new T(forward<Args>(args)...);
+		link(object, sizeof(T));
+		return object;
+	}
+
+	// Allocates an object that lives as long as the program. The only one
+	// today is the payload of a str constant read back from the program
+	// cache; the parser does not build string literals.
+	template <typename T, typename... Args>
+	T* allocatePinned(Args&&... args) {
+		T* object = allocate<T>(forward<Args>(args)...);
+		object->pinned = true;
+		return object;
+	}
+
+	void mark(GCObject* object) {
+		if (object == nullptr || object->marked)
+			return;
+		object->marked = true;
+		grey.push_back(object);
+	}
+
+	void collect() {
+		auto start = chrono::steady_clock::now();
+		if (markRoots != nullptr)
+			markRoots();
+		while (!grey.empty()) {
+			GCObject* object = grey.back();
+			grey.pop_back();
+			object->trace();
+		}
+
+		GCObject** link = &objects;
+		while (*link != nullptr) {
+			GCObject* object = *link;
+			if (object->marked || object->pinned) {
+				object->marked = false;
+				link = &object->next;
+				continue;
+			}
+			*link = object->next;
+			liveBytes -= object->size;
+			stats.gcObjectsFreed++;
+			stats.gcBytesFreed += object->size;
+			delete object;
+		}
+
+		allocatedSinceCollection = 0;
+		nextCollection = max(minThreshold, (size_t)(liveBytes * growth));
+		double pause = secondsSince(start);
+		stats.gcCollections++;
+		stats.gcPauseSeconds += pause;
+		stats.gcMaxPauseSeconds = max(stats.gcMaxPauseSeconds, pause);
+	}
+
+	~Heap() {
+		while (objects != nullptr) {
+			GCObject* object = objects;
+			objects = object->next;
+			delete object;
+		}
+	}
+};
+
+Heap heap;
@@ -0,0 +1,505 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include "parser.hpp"
+#include "typechecker.hpp"
+#include "optimizer.hpp"
+using namespace std;
+
+/*
+	Inliner, run by the optimizer on each function body before it folds
+	constants; --no-inline turns it off. A call to a small script function is
+	replaced by a copy of the callee's body when the call is a whole
+	statement: the value of an assignment, a returned value or an expression
+	statement. A call inside a larger expression stays a call, since no
+	expression can hold the statements of a body.
+
+	The copy runs in the caller's frame. Each parameter and local of the
+	callee gets a new slot after the caller's, and a new name of the form
+	callee.name.site that no script variable can shadow. A parameter whose
+	argument is a literal or a plain local of the caller, and which the
+	callee never assigns, reads that argument directly. The others are
+	declared and assigned their arguments in order before the body, which
+	keeps the order in which the call evaluated them. In the copy a return
+	becomes an assignment to the call's target, or just its value for an
+	expression statement; below a return in the caller the callee's returns
+	stay as they are.
+
+	A callee is inlined when its body is parsed, has at most inlineBudget
+	nodes, calls neither itself nor the caller, and the type checker knows
+	the type of every argument, so its parameters hold their declared types
+	without the checks of a call. A callee that returns from inside a loop,
+	or from one branch of an if that more statements follow, keeps its calls.
+*/
+
+bool inlineAST = true;
+int inlineBudget = 32;
+
+// What happens to the value a copied body returns.
+enum InlineTarget {
+	INLINE_ASSIGN,
+	INLINE_RETURN,
+	INLINE_DISCARD,
+};
+
+bool containsReturn(Statement* statement);
+
+bool containsReturn(Expression* expression) {
+	if (expression->type == RETURN_BLOCK)
+		return true;
+	return expression->type == STATEMENT_WRAPPER && containsReturn(((StatementWrapper*)expression)->statement);
+}
+
+bool containsReturn(Statement* statement) {
+	switch (statement->type) {
+	case BLOCK:
+		for (Statement* child : ((Block*)statement)->statements) {
+			if (containsReturn(child))
+				return true;
+		}
+		return false;
+	case IF_STATEMENT: {
+		IfStatement* ifStatement = (IfStatement*)statement;
+		return containsReturn(ifStatement->ifBlock) || (ifStatement->elseBlock != nullptr && containsReturn(ifStatement->elseBlock));
+	}
+	case WHILE_STATEMENT:
+		return containsReturn(((WhileStatement*)statement)->block);
+	case EXPR_WRAPPER:
+		return containsReturn(((ExpressionWrapper*)statement)->expression);
+	default:
+		return false;
+	}
+}
+
+bool callsFunction(Statement* statement, Function* target);
+
+bool callsFunction(Expression* expression, Function* target) {
+	switch (expression->type) {
+	case OPERATOR:
+		return callsFunction(((Operator*)expression)->left, target) || callsFunction(((Operator*)expression)->right, target);
+	case FUNCTION_CALL: {
+		FunctionCall* call = (FunctionCall*)expression;
+		if (call->callee == nullptr || call->callee->definition() == target)
+			return true;
+		for (Expression* param : call->params) {
+			if (callsFunction(param, target))
+				return true;
+		}
+		return false;
+	}
+	case RETURN_BLOCK:
+		return callsFunction(((Return*)expression)->expression, target);
+	case STATEMENT_WRAPPER:
+		return callsFunction(((StatementWrapper*)expression)->statement, target);
+	default:
+		return false;
+	}
+}
+
+bool callsFunction(Statement* statement, Function* target) {
+	switch (statement->type) {
+	case BLOCK:
+		for (Statement* child : ((Block*)statement)->statements) {
+			if (callsFunction(child, target))
+				return true;
+		}
+		return false;
+	case ASSIGNMENT:
+		return callsFunction(((Assignment*)statement)->expression, target);
+	case IF_STATEMENT: {
+		IfStatement* ifStatement = (IfStatement*)statement;
+		return callsFunction(ifStatement->condition, target) || callsFunction(ifStatement->ifBlock, target) || (ifStatement->elseBlock != nullptr && callsFunction(ifStatement->elseBlock, target));
+	}
+	case WHILE_STATEMENT:
+		return callsFunction(((WhileStatement*)statement)->condition, target) || callsFunction(((WhileStatement*)statement)->block, target);
+	case EXPR_WRAPPER:
+		return callsFunction(((ExpressionWrapper*)statement)->expression, target);
+	default:
+		return false;
+	}
+}
+
+// The statements of a function body, the form the optimizer works on.
+vector<Statement*> bodyStatements(ReturnBlock* block) {
+	vector<Statement*> statements;
+	for (Expression* expression : block->expressions) {
+		if (expression->type == STATEMENT_WRAPPER)
+			statements.push_back(((StatementWrapper*)expression)->statement);
+		else
+			statements.push_back(arenaNew<ExpressionWrapper>(expression));
+	}
+	return statements;
+}
+
+// Appends statements[start..] to out with every return moved to the end of
+// its path: an if that returns on one branch takes the statements after it
+// into the other. Fails for a return in a loop, or in an if whose branches
+// can both fall through to more statements.
+bool moveReturnsToEnd(const vector<Statement*>& statements, size_t start, vector<Statement*>& out) {
+	for (size_t i = start; i < statements.size(); i++) {
+		Statement* statement = statements[i];
+		if (statement->type == EXPR_WRAPPER && ((ExpressionWrapper*)statement)->expression->type == STATEMENT_WRAPPER)
+			statement = ((StatementWrapper*)((ExpressionWrapper*)statement)->expression)->statement;
+		if (!containsReturn(statement)) {
+			out.push_back(statement);
+			continue;
+		}
+		vector<Statement*> rest(statements.begin() + i + 1, statements.end());
+		switch (statement->type) {
+		case EXPR_WRAPPER:
+			out.push_back(statement);
+			return true;
+		case BLOCK: {
+			vector<Statement*> spliced = ((Block*)statement)->statements;
+			spliced.insert(spliced.end(), rest.begin(), rest.end());
+			return moveReturnsToEnd(spliced, 0, out);
+		}
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			bool ifReturns = alwaysReturns(ifStatement->ifBlock);
+			bool elseReturns = ifStatement->elseBlock != nullptr && alwaysReturns(ifStatement->elseBlock);
+			if (!ifReturns && !elseReturns && !rest.empty())
+				return false;
+			vector<Statement*> ifPart = ifStatement->ifBlock->statements;
+			vector<Statement*> elsePart;
+			if (ifStatement->elseBlock != nullptr)
+				elsePart = ifStatement->elseBlock->statements;
+			if (!ifReturns)
+				ifPart.insert(ifPart.end(), rest.begin(), rest.end());
+			if (!elseReturns)
+				elsePart.insert(elsePart.end(), rest.begin(), rest.end());
+			Block* ifBlock = arenaNew<Block>();
+			Block* elseBlock = arenaNew<Block>();
+			if (!moveReturnsToEnd(ifPart, 0, ifBlock->statements) || !moveReturnsToEnd(elsePart, 0, elseBlock->statements))
+				return false;
+			out.push_back(arenaNew<IfStatement>(ifStatement->condition, ifBlock, elseBlock->statements.empty() ? nullptr : elseBlock));
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+// Copies one callee body into one call site.
+class InlineSite {
+private:
+	Function* callee;
+	FunctionCall* call;
+	InlineTarget target;
+	// The assignment the call was the value of, for INLINE_ASSIGN.
+	Assignment* assignment;
+	// Caller slot and name of each callee slot.
+	vector<int> slots;
+	vector<Symbol> names;
+	// Argument read in place of each parameter, or nullptr if it is bound.
+	vector<Expression*> substitutes;
+
+	void name(int slot, Symbol original, int site) {
+		names[slot] = symbols.intern(symbols.name(callee->name) + "." + symbols.name(original) + "." + to_string(site));
+	}
+
+	void nameLocals(Statement* statement, int site) {
+		switch (statement->type) {
+		case BLOCK:
+			for (Statement* child : ((Block*)statement)->statements)
+				nameLocals(child, site);
+			break;
+		case DECLARATION:
+			name(((Declaration*)statement)->slot, ((Declaration*)statement)->identifier, site);
+			break;
+		case IF_STATEMENT:
+			nameLocals(((IfStatement*)statement)->ifBlock, site);
+			if (((IfStatement*)statement)->elseBlock != nullptr)
+				nameLocals(((IfStatement*)statement)->elseBlock, site);
+			break;
+		case WHILE_STATEMENT:
+			nameLocals(((WhileStatement*)statement)->block, site);
+			break;
+		case EXPR_WRAPPER:
+			if (((ExpressionWrapper*)statement)->expression->type == STATEMENT_WRAPPER)
+				nameLocals(((StatementWrapper*)((ExpressionWrapper*)statement)->expression)->statement, site);
+			break;
+		default:
+			break;
+		}
+	}
+
+	bool assignsSlot(Statement* statement, int slot) {
+		switch (statement->type) {
+		case BLOCK:
+			for (Statement* child : ((Block*)statement)->statements) {
+				if (assignsSlot(child, slot))
+					return true;
+			}
+			return false;
+		case ASSIGNMENT:
+			return ((Assignment*)statement)->identifier.members.size() == 1 && ((Assignment*)statement)->identifier.slot == slot;
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			return assignsSlot(ifStatement->ifBlock, slot) || (ifStatement->elseBlock != nullptr && assignsSlot(ifStatement->elseBlock, slot));
+		}
+		case WHILE_STATEMENT:
+			return assignsSlot(((WhileStatement*)statement)->block, slot);
+		case EXPR_WRAPPER:
+			return ((ExpressionWrapper*)statement)->expression->type == STATEMENT_WRAPPER && assignsSlot(((StatementWrapper*)((ExpressionWrapper*)statement)->expression)->statement, slot);
+		default:
+			return false;
+		}
+	}
+
+	// Literals are only read in place for scalar parameters, which have no
+	// members.
+	bool canSubstitute(Expression* argument, DataType type) {
+		if (argument->type == LITERAL)
+			return ((Literal*)argument)->data.type == type && (type == INT || type == FLOAT || type == BOOL);
+		return argument->type == VARIABLE && ((Variable*)argument)->members.members.size() == 1;
+	}
+
+	MemberList renamed(const MemberList& members) {
+		MemberList copy = members;
+		Expression* substitute = substitutes[members.slot];
+		if (substitute != nullptr) {
+			const MemberList& root = ((Variable*)substitute)->members;
+			copy.slot = root.slot;
+			copy.members[0] = root.members[0];
+		}
+		else {
+			copy.slot = slots[members.slot];
+			copy.members[0] = names[members.slot];
+		}
+		return copy;
+	}
+
+	Expression* copy(Expression* expression) {
+		switch (expression->type) {
+		case VARIABLE: {
+			Variable* variable = (Variable*)expression;
+			Expression* substitute = substitutes[variable->members.slot];
+			if (substitute != nullptr && substitute->type == LITERAL)
+				return substitute;
+			Variable* result = arenaNew<Variable>(*variable);
+			result->members = renamed(variable->members);
+			return result;
+		}
+		case OPERATOR: {
+			Operator* result = arenaNew<Operator>(*(Operator*)expression);
+			result->left = copy(result->left);
+			result->right = copy(result->right);
+			return result;
+		}
+		case FUNCTION_CALL: {
+			FunctionCall* result = arenaNew<FunctionCall>(*(FunctionCall*)expression);
+			for (Expression*& param : result->params)
+				param = copy(param);
+			return result;
+		}
+		case RETURN_BLOCK: {
+			Return* result = arenaNew<Return>(*(Return*)expression);
+			result->expression = copy(result->expression);
+			return result;
+		}
+		case STATEMENT_WRAPPER:
+			return arenaNew<StatementWrapper>(copy(((StatementWrapper*)expression)->statement));
+		default:
+			return expression;
+		}
+	}
+
+	Block* copy(Block* block) {
+		Block* result = arenaNew<Block>();
+		for (Statement* statement : block->statements)
+			result->statements.push_back(copy(statement));
+		return result;
+	}
+
+	Statement* copy(Statement* statement) {
+		switch (statement->type) {
+		case BLOCK:
+			return copy((Block*)statement);
+		case DECLARATION: {
+			Declaration* decleration = (Declaration*)statement;
+			return arenaNew<Declaration>(names[decleration->slot], decleration->type, slots[decleration->slot]);
+		}
+		case ASSIGNMENT: {
+			Assignment* assignment = (Assignment*)statement;
+			return arenaNew<Assignment>(renamed(assignment->identifier), copy(assignment->expression));
+		}
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			return arenaNew<IfStatement>(copy(ifStatement->condition), copy(ifStatement->ifBlock), ifStatement->elseBlock != nullptr ? copy(ifStatement->elseBlock) : nullptr);
+		}
+		case WHILE_STATEMENT: {
+			WhileStatement* whileStatement = (WhileStatement*)statement;
+			return arenaNew<WhileStatement>(copy(whileStatement->condition), copy(whileStatement->block));
+		}
+		case EXPR_WRAPPER: {
+			Expression* expression = ((ExpressionWrapper*)statement)->expression;
+			if (expression->type != RETURN_BLOCK || target == INLINE_RETURN)
+				return arenaNew<ExpressionWrapper>(copy(expression));
+			Expression* value = copy(((Return*)expression)->expression);
+			if (target == INLINE_ASSIGN)
+				return arenaNew<Assignment>(assignment->identifier, value);
+			return arenaNew<ExpressionWrapper>(value);
+		}
+		default:
+			return statement;
+		}
+	}
+
+public:
+	InlineSite(Function* callee, FunctionCall* call, InlineTarget target, Assignment* assignment) : callee(callee), call(call), target(target), assignment(assignment) {}
+
+	// Builds the block that replaces the call, taking the callee's slots from
+	// the end of the caller's frame. Returns nullptr if the body's returns
+	// cannot all be rewritten.
+	Block* build(Function* caller) {
+		vector<Statement*> statements = bodyStatements(callee->block);
+		if (target != INLINE_RETURN) {
+			vector<Statement*> moved;
+			if (!moveReturnsToEnd(statements, 0, moved))
+				return nullptr;
+			statements = moved;
+		}
+		int site = stats.callsInlined;
+		slots.resize(callee->frameSize);
+		names.resize(callee->frameSize, NO_SYMBOL);
+		substitutes.resize(callee->frameSize, nullptr);
+		for (int i = 0; i < callee->frameSize; i++)
+			slots[i] = caller->frameSize + i;
+		for (Statement* statement : statements)
+			nameLocals(statement, site);
+
+		Block* result = arenaNew<Block>();
+		for (int i = 0; i < callee->list.params.size(); i++) {
+			Expression* argument = call->params[i];
+			DataType type = callee->list.params[i].second;
+			bool assigned = false;
+			for (Statement* statement : statements)
+				assigned = assigned || assignsSlot(statement, i);
+			if (!assigned && canSubstitute(argument, type)) {
+				substitutes[i] = argument;
+				continue;
+			}
+			name(i, callee->list.params[i].first, site);
+			MemberList parameter(names[i]);
+			parameter.slot = slots[i];
+			parameter.rootType = type;
+			result->statements.push_back(arenaNew<Declaration>(names[i], type, slots[i]));
+			result->statements.push_back(arenaNew<Assignment>(parameter, argument));
+		}
+		for (Statement* statement : statements)
+			result->statements.push_back(copy(statement));
+		caller->frameSize += callee->frameSize;
+		return result;
+	}
+};
+
+// The script function a call can be inlined from, or nullptr.
+Function* inlineCandidate(Function* caller, FunctionCall* call, InlineTarget target) {
+	if (call->callee == nullptr)
+		return nullptr;
+	Function* callee = call->callee->definition();
+	if (callee == nullptr || callee == caller || callee->block == nullptr)
+		return nullptr;
+	// Without the checker's types a parameter could receive a value of
+	// another type, which only the checks of a call would report.
+	if (!typeCheckAST)
+		return nullptr;
+	for (int i = 0; i < call->params.size(); i++) {
+		if (call->params[i]->staticType != callee->list.params[i].second)
+			return nullptr;
+	}
+	if (countNodes(callee->block) > inlineBudget)
+		return nullptr;
+	if (target != INLINE_DISCARD && !alwaysReturns(callee->block))
+		return nullptr;
+	for (Expression* expression : callee->block->expressions) {
+		if (callsFunction(expression, callee) || callsFunction(expression, caller))
+			return nullptr;
+	}
+	return callee;
+}
+
+class Inliner {
+private:
+	Function* caller;
+
+	// Returns the block to put in place of statement, or nullptr to keep it.
+	Block* inlineStatement(Statement* statement) {
+		FunctionCall* call = nullptr;
+		InlineTarget target = INLINE_DISCARD;
+		Assignment* assignment = nullptr;
+		if (statement->type == ASSIGNMENT) {
+			assignment = (Assignment*)statement;
+			if (assignment->expression->type != FUNCTION_CALL)
+				return nullptr;
+			call = (FunctionCall*)assignment->expression;
+			target = INLINE_ASSIGN;
+		}
+		else if (statement->type == EXPR_WRAPPER) {
+			Expression* expression = ((ExpressionWrapper*)statement)->expression;
+			if (expression->type == RETURN_BLOCK) {
+				expression = ((Return*)expression)->expression;
+				target = INLINE_RETURN;
+			}
+			if (expression->type != FUNCTION_CALL)
+				return nullptr;
+			call = (FunctionCall*)expression;
+		}
+		else {
+			return nullptr;
+		}
+		Function* callee = inlineCandidate(caller, call, target);
+		if (callee == nullptr)
+			return nullptr;
+		InlineSite site(callee, call, target, assignment);
+		Block* block = site.build(caller);
+		if (block != nullptr) {
+			stats.callsInlined++;
+			nodesAdded += countNodes(block) - countNodes(statement);
+		}
+		return block;
+	}
+
+public:
+	int nodesAdded = 0;
+
+	Inliner(Function* caller) : caller(caller) {}
+
+	void run(vector<Statement*>& statements) {
+		for (Statement*& statement : statements) {
+			switch (statement->type) {
+			case BLOCK:
+				run(((Block*)statement)->statements);
+				break;
+			case IF_STATEMENT:
+				run(((IfStatement*)statement)->ifBlock->statements);
+				if (((IfStatement*)statement)->elseBlock != nullptr)
+					run(((IfStatement*)statement)->elseBlock->statements);
+				break;
+			case WHILE_STATEMENT:
+				run(((WhileStatement*)statement)->block->statements);
+				break;
+			default: {
+				Block* block = inlineStatement(statement);
+				if (block != nullptr)
+					statement = block;
+				break;
+			}
+			}
+		}
+	}
+};
+
+// Inlines the calls in a body the optimizer is about to rebuild. Returns the
+// number of nodes that added.
+int inlineCalls(Function* caller, Block* body) {
+	if (!inlineAST)
+		return 0;
+	Inliner inliner(caller);
+	inliner.run(body->statements);
+	return inliner.nodesAdded;
+}
@@ -0,0 +1,599 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include "parser.hpp"
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+using namespace std;
+
+/*
+	Baseline x86-64 JIT for numeric functions, enabled with --jit on the tree
+	engine. Every script function sits behind a JitFunction that counts its
+	calls; at jitThreshold calls it tries to compile the function to machine
+	code and from then on runs it natively.
+
+	A function compiles when its parameters, locals and return value are all
+	int, float or bool, its body uses only declarations, assignments to
+	locals, if, while, return, literals, operators the interpreter accepts for
+	those types and calls to other functions that compile, and every path
+	ends in a return. Anything else leaves it on the interpreter, which also
+	keeps every runtime error message where it was.
+
+	Native code is a simple stack machine: rbx points at the frame, an array
+	of 32 bit slots numbered like valueStack slots, results are in eax (floats
+	as their bits) and pending left operands are pushed on the machine stack.
+	A native call builds the callee's frame on the machine stack and calls
+	through the callee's entry field, so recursion and calls to functions
+	still being compiled work.
+
+	--jit-verify runs every native call made from the interpreter a second
+	time on the interpreter and stops on the first different result.
+*/
+
+typedef int32_t (*NativeFunction)(int32_t* frame);
+
+int jitThreshold = 100;
+bool jitVerify = false;
+// Set while --jit-verify reruns a call, so the calls it makes are
+// interpreted as well.
+bool jitVerifying = false;
+// Frames of the native calls made from the interpreter, reused so that a call
+// does not allocate.
+vector<int32_t> nativeFrames;
+
+class JitFunction : public Callable {
+public:
+	Function* function;
+	int calls = 0;
+	// Native callers call through this field, so it is filled in only once
+	// the code is ready.
+	NativeFunction entry = nullptr;
+	bool compiling = false;
+	bool rejected = false;
+	JitFunction(Function* function) : function(function) {}
+
+	void call(DataSpan args, Data& result);
+
+	int arity() override {
+		return function->arity();
+	}
+
+	Function* definition() override {
+		return function;
+	}
+};
+
+bool jitCompile(JitFunction* function);
+
+int32_t toNative(Data data) {
+	int32_t bits = 0;
+	if (data.type == FLOAT)
+		memcpy(&bits, &data.floatValue, sizeof(bits));
+	else if (data.type == BOOL)
+		bits = data.boolValue;
+	else
+		bits = data.intValue;
+	return bits;
+}
+
+Data fromNative(DataType type, int32_t bits) {
+	if (type == FLOAT) {
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return makeFloat(value);
+	}
+	if (type == BOOL)
+		return makeBool(bits != 0);
+	return makeInt(bits);
+}
+
+bool sameResult(Data a, Data b) {
+	return a.type == b.type && toNative(a) == toNative(b);
+}
+
+void JitFunction::call(DataSpan args, Data& result) {
+	if (jitVerifying) {
+		function->call(args, result);
+		return;
+	}
+	if (entry == nullptr && !rejected && ++calls >= jitThreshold)
+		jitCompile(this);
+	if (entry == nullptr) {
+		function->call(args, result);
+		return;
+	}
+	// The interpreter does not check argument types, so a call whose
+	// arguments differ from the declared types stays interpreted.
+	for (int i = 0; i < args.size(); i++) {
+		if (args[i].type != function->list.params[i].second) {
+			function->call(args, result);
+			return;
+		}
+	}
+
+	size_t base = nativeFrames.size();
+	nativeFrames.resize(base + function->frameSize);
+	for (int i = 0; i < args.size(); i++)
+		nativeFrames[base + i] = toNative(args[i]);
+	result = fromNative(function->returnType, entry(nativeFrames.data() + base));
+	nativeFrames.resize(base);
+	stats.jitNativeCalls++;
+	if (jitVerify) {
+		jitVerifying = true;
+		Data expected;
+		function->call(args, expected);
+		jitVerifying = false;
+		if (!sameResult(result, expected)) {
+			cerr << "Error: jit result " << DataToString(result) << " differs from interpreter result " << DataToString(expected) << " in " << symbols.name(function->name) << endl;
+			exit(1);
+		}
+		stats.jitVerifiedCalls++;
+	}
+}
+
+class CodeBuffer {
+public:
+	vector<uint8_t> bytes;
+
+	void emit(initializer_list<uint8_t> code) {
+		bytes.insert(bytes.end(), code);
+	}
+
+	void emit32(int32_t value) {
+		uint8_t raw[4];
+		memcpy(raw, &value, 4);
+		bytes.insert(bytes.end(), raw, raw + 4);
+	}
+
+	void emit64(uint64_t value) {
+		uint8_t raw[8];
+		memcpy(raw, &value, 8);
+		bytes.insert(bytes.end(), raw, raw + 8);
+	}
+
+	// Emits a jump with a rel32 to be patched and returns where the rel32 is.
+	size_t jump(initializer_list<uint8_t> opcode) {
+		emit(opcode);
+		emit32(0);
+		return bytes.size() - 4;
+	}
+
+	void patch(size_t at, size_t target) {
+		int32_t offset = (int32_t)(target - (at + 4));
+		memcpy(&bytes[at], &offset, 4);
+	}
+
+	size_t here() {
+		return bytes.size();
+	}
+};
+
+class JitCompiler {
+private:
+	JitFunction* target;
+	CodeBuffer code;
+	vector<DataType> slotTypes;
+	// 8 byte values pushed since the prologue, for aligning calls.
+	int depth = 0;
+
+	static bool supported(DataType type) {
+		return type == INT || type == FLOAT || type == BOOL;
+	}
+
+	bool declareSlot(int slot, DataType type) {
+		if (!supported(type))
+			return false;
+		if (slot >= slotTypes.size())
+			slotTypes.resize(slot + 1, NULL_TYPE);
+		if (slotTypes[slot] != NULL_TYPE && slotTypes[slot] != type)
+			return false;
+		slotTypes[slot] = type;
+		return true;
+	}
+
+	bool collectSlots(Statement* statement) {
+		switch (statement->type) {
+		case BLOCK:
+			for (Statement* child : ((Block*)statement)->statements) {
+				if (!collectSlots(child))
+					return false;
+			}
+			return true;
+		case DECLARATION:
+			return declareSlot(((Declaration*)statement)->slot, ((Declaration*)statement)->type);
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			return collectSlots(ifStatement->ifBlock) && (ifStatement->elseBlock == nullptr || collectSlots(ifStatement->elseBlock));
+		}
+		case WHILE_STATEMENT:
+			return collectSlots(((WhileStatement*)statement)->block);
+		case ASSIGNMENT:
+		case EXPR_WRAPPER:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	DataType slotType(const MemberList& members) {
+		if (members.members.size() != 1 || members.slot >= slotTypes.size())
+			return NULL_TYPE;
+		return slotTypes[members.slot];
+	}
+
+	// Loads a literal or local straight into ecx, which saves the push and pop
+	// of the general case for the right operand. Returns NULL_TYPE for any
+	// other expression.
+	DataType loadSimpleOperand(Expression* expression) {
+		if (expression->type == LITERAL) {
+			Data data = ((Literal*)expression)->data;
+			if (!supported(data.type))
+				return NULL_TYPE;
+			code.emit({ 0xB9 }); // mov ecx, imm32
+			code.emit32(toNative(data));
+			return data.type;
+		}
+		if (expression->type == VARIABLE) {
+			const MemberList& members = ((Variable*)expression)->members;
+			DataType type = slotType(members);
+			if (type == NULL_TYPE)
+				return NULL_TYPE;
+			code.emit({ 0x8B, 0x8B }); // mov ecx, [rbx + disp32]
+			code.emit32(members.slot * 4);
+			return type;
+		}
+		return NULL_TYPE;
+	}
+
+	bool isSimpleOperand(Expression* expression) {
+		return expression->type == LITERAL || (expression->type == VARIABLE && ((Variable*)expression)->members.members.size() == 1);
+	}
+
+	// Applies kind to eax and ecx, leaving the result in eax. Only the type
+	// pairs applyOperator accepts are compiled.
+	DataType compileOperation(OperatorKind kind, DataType left, DataType right) {
+		if (left != right)
+			return NULL_TYPE;
+		if (left == INT) {
+			switch (kind) {
+			case OP_ADD: code.emit({ 0x01, 0xC8 }); return INT; // add eax, ecx
+			case OP_SUBTRACT: code.emit({ 0x29, 0xC8 }); return INT; // sub eax, ecx
+			case OP_MULTIPLY: code.emit({ 0x0F, 0xAF, 0xC1 }); return INT; // imul eax, ecx
+			case OP_DIVIDE: code.emit({ 0x99, 0xF7, 0xF9 }); return INT; // cdq; idiv ecx
+			case OP_GREATER: return compileCompare(0x9F); // setg
+			case OP_LESS: return compileCompare(0x9C); // setl
+			case OP_EQUAL: return compileCompare(0x94); // sete
+			case OP_NOT_EQUAL: return compileCompare(0x95); // setne
+			default: return NULL_TYPE;
+			}
+		}
+		if (left == FLOAT) {
+			uint8_t opcode;
+			switch (kind) {
+			case OP_ADD: opcode = 0x58; break; // addss
+			case OP_SUBTRACT: opcode = 0x5C; break; // subss
+			case OP_MULTIPLY: opcode = 0x59; break; // mulss
+			case OP_DIVIDE: opcode = 0x5E; break; // divss
+			default: return NULL_TYPE;
+			}
+			code.emit({ 0x66, 0x0F, 0x6E, 0xC0 }); // movd xmm0, eax
+			code.emit({ 0x66, 0x0F, 0x6E, 0xC9 }); // movd xmm1, ecx
+			code.emit({ 0xF3, 0x0F, opcode, 0xC1 }); // op xmm0, xmm1
+			code.emit({ 0x66, 0x0F, 0x7E, 0xC0 }); // movd eax, xmm0
+			return FLOAT;
+		}
+		if (left == BOOL) {
+			switch (kind) {
+			case OP_AND: code.emit({ 0x21, 0xC8 }); return BOOL; // and eax, ecx
+			case OP_OR: code.emit({ 0x09, 0xC8 }); return BOOL; // or eax, ecx
+			default: return NULL_TYPE;
+			}
+		}
+		return NULL_TYPE;
+	}
+
+	DataType compileCompare(uint8_t setcc) {
+		code.emit({ 0x39, 0xC8 }); // cmp eax, ecx
+		code.emit({ 0x0F, setcc, 0xC0 }); // setcc al
+		code.emit({ 0x0F, 0xB6, 0xC0 }); // movzx eax, al
+		return BOOL;
+	}
+
+	DataType compileCall(FunctionCall* call) {
+		JitFunction* callee = dynamic_cast<JitFunction*>(call->callee);
+		if (callee == nullptr)
+			return NULL_TYPE;
+		if (callee->function->block == nullptr)
+			callee->function->parseBody();
+		if (!jitCompile(callee))
+			return NULL_TYPE;
+		const ParameterList& list = callee->function->list;
+		for (int i = 0; i < call->params.size(); i++) {
+			if (compileExpression(call->params[i]) != list.params[i].second)
+				return NULL_TYPE;
+			code.emit({ 0x50 }); // push rax
+			depth++;
+		}
+
+		int argc = call->params.size();
+		int32_t frameBytes = (callee->function->frameSize * 4 + 15) & ~15;
+		int32_t padding = depth % 2 == 1 ? 8 : 0;
+		code.emit({ 0x48, 0x81, 0xEC }); // sub rsp, imm32
+		code.emit32(frameBytes + padding);
+		for (int i = 0; i < argc; i++) {
+			code.emit({ 0x8B, 0x84, 0x24 }); // mov eax, [rsp + disp32]
+			code.emit32(frameBytes + padding + 8 * (argc - 1 - i));
+			code.emit({ 0x89, 0x84, 0x24 }); // mov [rsp + disp32], eax
+			code.emit32(4 * i);
+		}
+		code.emit({ 0x48, 0x89, 0xE7 }); // mov rdi, rsp
+		code.emit({ 0x48, 0xB8 }); // mov rax, imm64
+		code.emit64((uint64_t)&callee->entry);
+		code.emit({ 0xFF, 0x10 }); // call [rax]
+		code.emit({ 0x48, 0x81, 0xC4 }); // add rsp, imm32
+		code.emit32(frameBytes + padding + 8 * argc);
+		depth -= argc;
+		return callee->function->returnType;
+	}
+
+	// Leaves the value in eax and returns its type, or NULL_TYPE when the
+	// expression cannot be compiled.
+	DataType compileExpression(Expression* expression) {
+		switch (expression->type) {
+		case LITERAL: {
+			Data data = ((Literal*)expression)->data;
+			if (!supported(data.type))
+				return NULL_TYPE;
+			code.emit({ 0xB8 }); // mov eax, imm32
+			code.emit32(toNative(data));
+			return data.type;
+		}
+		case VARIABLE: {
+			const MemberList& members = ((Variable*)expression)->members;
+			DataType type = slotType(members);
+			if (type == NULL_TYPE)
+				return NULL_TYPE;
+			code.emit({ 0x8B, 0x83 }); // mov eax, [rbx + disp32]
+			code.emit32(members.slot * 4);
+			return type;
+		}
+		case OPERATOR: {
+			Operator* op = (Operator*)expression;
+			DataType left = compileExpression(op->left);
+			if (left == NULL_TYPE)
+				return NULL_TYPE;
+			DataType right;
+			if (isSimpleOperand(op->right)) {
+				right = loadSimpleOperand(op->right);
+			}
+			else {
+				code.emit({ 0x50 }); // push rax
+				depth++;
+				right = compileExpression(op->right);
+				code.emit({ 0x89, 0xC1 }); // mov ecx, eax
+				code.emit({ 0x58 }); // pop rax
+				depth--;
+			}
+			if (right == NULL_TYPE)
+				return NULL_TYPE;
+			return compileOperation(op->kind, left, right);
+		}
+		case FUNCTION_CALL:
+			return compileCall((FunctionCall*)expression);
+		default:
+			return NULL_TYPE;
+		}
+	}
+
+	void compileEpilogue() {
+		code.emit({ 0x48, 0x8D, 0x65, 0xF8 }); // lea rsp, [rbp - 8]
+		code.emit({ 0x5B }); // pop rbx
+		code.emit({ 0x5D }); // pop rbp
+		code.emit({ 0xC3 }); // ret
+	}
+
+	bool compileEffect(Expression* expression) {
+		if (expression->type == RETURN_BLOCK) {
+			if (compileExpression(((Return*)expression)->expression) != target->function->returnType)
+				return false;
+			compileEpilogue();
+			return true;
+		}
+		if (expression->type == STATEMENT_WRAPPER)
+			return compileStatement(((StatementWrapper*)expression)->statement);
+		return compileExpression(expression) != NULL_TYPE;
+	}
+
+	bool compileCondition(Expression* condition, size_t& exitJump) {
+		if (compileExpression(condition) != BOOL)
+			return false;
+		code.emit({ 0x85, 0xC0 }); // test eax, eax
+		exitJump = code.jump({ 0x0F, 0x84 }); // jz rel32
+		return true;
+	}
+
+	bool compileStatement(Statement* statement) {
+		switch (statement->type) {
+		case BLOCK:
+			for (Statement* child : ((Block*)statement)->statements) {
+				if (!compileStatement(child))
+					return false;
+			}
+			return true;
+		case DECLARATION: {
+			code.emit({ 0xC7, 0x83 }); // mov dword [rbx + disp32], imm32
+			code.emit32(((Declaration*)statement)->slot * 4);
+			code.emit32(0);
+			return true;
+		}
+		case ASSIGNMENT: {
+			Assignment* assignment = (Assignment*)statement;
+			DataType type = slotType(assignment->identifier);
+			if (type == NULL_TYPE || compileExpression(assignment->expression) != type)
+				return false;
+			code.emit({ 0x89, 0x83 }); // mov [rbx + disp32], eax
+			code.emit32(assignment->identifier.slot * 4);
+			return true;
+		}
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			size_t elseJump;
+			if (!compileCondition(ifStatement->condition, elseJump) || !compileStatement(ifStatement->ifBlock))
+				return false;
+			if (ifStatement->elseBlock == nullptr) {
+				code.patch(elseJump, code.here());
+				return true;
+			}
+			size_t endJump = code.jump({ 0xE9 }); // jmp rel32
+			code.patch(elseJump, code.here());
+			if (!compileStatement(ifStatement->elseBlock))
+				return false;
+			code.patch(endJump, code.here());
+			return true;
+		}
+		case WHILE_STATEMENT: {
+			WhileStatement* whileStatement = (WhileStatement*)statement;
+			size_t top = code.here();
+			size_t exitJump;
+			if (!compileCondition(whileStatement->condition, exitJump) || !compileStatement(whileStatement->block))
+				return false;
+			size_t backJump = code.jump({ 0xE9 }); // jmp rel32
+			code.patch(backJump, top);
+			code.patch(exitJump, code.here());
+			return true;
+		}
+		case EXPR_WRAPPER:
+			return compileEffect(((ExpressionWrapper*)statement)->expression);
+		default:
+			return false;
+		}
+	}
+
+public:
+	JitCompiler(JitFunction* target) : target(target) {}
+
+	bool compile() {
+		Function* function = target->function;
+		if (function->block == nullptr)
+			function->parseBody();
+		if (!supported(function->returnType))
+			return false;
+		for (int i = 0; i < function->list.params.size(); i++) {
+			if (!declareSlot(i, function->list.params[i].second))
+				return false;
+		}
+		for (Expression* expression : function->block->expressions) {
+			if (expression->type == STATEMENT_WRAPPER && !collectSlots(((StatementWrapper*)expression)->statement))
+				return false;
+		}
+		if (!alwaysReturns(function->block))
+			return false;
+
+		code.emit({ 0x55 }); // push rbp
+		code.emit({ 0x48, 0x89, 0xE5 }); // mov rbp, rsp
+		code.emit({ 0x53 }); // push rbx
+		code.emit({ 0x48, 0x83, 0xEC, 0x08 }); // sub rsp, 8
+		code.emit({ 0x48, 0x89, 0xFB }); // mov rbx, rdi
+		for (Expression* expression : function->block->expressions) {
+			if (!compileEffect(expression))
+				return false;
+		}
+		code.emit({ 0x0F, 0x0B }); // ud2, every path returned before here
+		return true;
+	}
+
+	const vector<uint8_t>& bytes() {
+		return code.bytes;
+	}
+};
+
+// Functions compiled during the outermost jitCompile. Their entries are set
+// together once it succeeds, since code compiled for a callee may call a
+// function that is still being compiled and could yet be rejected.
+struct PendingCode {
+	JitFunction* function;
+	void* memory;
+	size_t size;
+	size_t codeBytes;
+};
+vector<PendingCode> pendingCode;
+int jitNesting = 0;
+
+void* installCode(const vector<uint8_t>& bytes, size_t& size) {
+#if JIT_SUPPORTED
+	size_t page = sysconf(_SC_PAGESIZE);
+	size = (bytes.size() + page - 1) / page * page;
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return nullptr;
+	memcpy(memory, bytes.data(), bytes.size());
+	if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(memory, size);
+		return nullptr;
+	}
+	return memory;
+#else
+	return nullptr;
+#endif
+}
+
+// Returns false when the function has to stay on the interpreter. A function
+// already being compiled counts as compiled, which is what lets recursive
+// calls through its entry be emitted.
+bool jitCompile(JitFunction* function) {
+	if (function->entry != nullptr || function->compiling)
+		return true;
+	if (function->rejected)
+		return false;
+	function->compiling = true;
+	jitNesting++;
+	JitCompiler compiler(function);
+	bool compiled = compiler.compile();
+	size_t size = 0;
+	void* memory = compiled ? installCode(compiler.bytes(), size) : nullptr;
+	jitNesting--;
+	function->compiling = false;
+	if (memory == nullptr) {
+		function->rejected = true;
+		stats.jitRejected++;
+	}
+	else {
+		pendingCode.push_back({ function, memory, size, compiler.bytes().size() });
+	}
+	if (jitNesting > 0)
+		return memory != nullptr;
+
+	for (const PendingCode& pending : pendingCode) {
+		if (memory != nullptr) {
+			pending.function->entry = (NativeFunction)pending.memory;
+			stats.jitCompiled++;
+			stats.jitCodeBytes += pending.codeBytes;
+		}
+		else {
+#if JIT_SUPPORTED
+			munmap(pending.memory, pending.size);
+#endif
+		}
+	}
+	pendingCode.clear();
+	return memory != nullptr;
+}
+
+// Puts a JitFunction in front of every script function. Runs before the
+// program is linked, so call sites count calls through it.
+void installJit() {
+	for (Symbol name = 0; name < functions.size(); name++) {
+		Function* function = dynamic_cast<Function*>(functions.get(name));
+		if (function != nullptr)
+			functions[name] = new JitFunction(function);
+	}
+}
@@ -8,30 +8,183 @@
 #include "util.hpp"
 #include "tokenizer.hpp"
 #include "parser.hpp"
+#include "cache.hpp"
+#include "vm.hpp"
+#include "closure.hpp"
+#include "jit.hpp"
+#include "transpiler.hpp"
+#include "typechecker.hpp"
+#include "optimizer.hpp"
+#include "inliner.hpp"
 using namespace std;
 
 
-int main() {
-	vector<string> lines = readLinesFromFile("expressions.pys");
-	vector<Token> tokens = tokenize(lines);
-	for (auto token : tokens) {
-		cout << token << endl;
+int main(int argc, char** argv) {
+	int parseThreads = 1;
+	bool lazyParse = false;
+	bool showStats = false;
+	bool useCache = true;
+	bool dumpTokens = false;
+	bool lexOnly = false;
+	string engine = "tree";
+	bool jit = false;
+	string emitCppPath;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.rfind("--parse-threads=", 0) == 0) {
+			parseThreads = stoi(arg.substr(16));
+			if (parseThreads == 0)
+				parseThreads = thread::hardware_concurrency();
+		}
+		else if (arg == "--lazy-parse") {
+			lazyParse = true;
+		}
+		else if (arg == "--stats") {
+			showStats = true;
+		}
+		else if (arg == "--no-cache") {
+			useCache = false;
+		}
+		else if (arg == "--dump-tokens") {
+			dumpTokens = true;
+		}
+		else if (arg == "--lex-only") {
+			lexOnly = true;
+		}
+		else if (arg.rfind("--scan-kernels=", 0) == 0) {
+			if (!setScanKernels(arg.substr(15))) {
+				cerr << "Error: unknown or unsupported scan kernels " << arg.substr(15) << ", expected auto, scalar, sse2 or avx2" << endl;
+				return 1;
+			}
+		}
+		else if (arg.rfind("--engine=", 0) == 0) {
+			engine = arg.substr(9);
+			if (engine != "tree" && engine != "vm" && engine != "closure") {
+				cerr << "Error: unknown engine " << engine << ", expected tree, vm or closure" << endl;
+				return 1;
+			}
+		}
+		else if (arg == "--jit") {
+			jit = true;
+		}
+		else if (arg.rfind("--jit-threshold=", 0) == 0) {
+			jit = true;
+			jitThreshold = stoi(arg.substr(16));
+		}
+		else if (arg == "--jit-verify") {
+			jit = true;
+			jitVerify = true;
+		}
+		else if (arg == "--no-type-check") {
+			typeCheckAST = false;
+		}
+		else if (arg == "--no-optimize") {
+			optimizeAST = false;
+		}
+		else if (arg == "--no-inline") {
+			inlineAST = false;
+		}
+		else if (arg.rfind("--inline-budget=", 0) == 0) {
+			inlineBudget = stoi(arg.substr(16));
+		}
+		else if (arg.rfind("--emit-cpp=", 0) == 0) {
+			emitCppPath = arg.substr(11);
+		}
+		else if (arg.rfind("--gc-threshold=", 0) == 0) {
+			heap.setThreshold(stoull(arg.substr(15)));
+		}
+		else if (arg.rfind("--gc-growth=", 0) == 0) {
+			heap.growth = stod(arg.substr(12));
+		}
+		else {
+			cerr << "Error: unknown argument " << arg << endl;
+			return 1;
+		}
 	}
-	StructPass(tokens);
+
+	heap.markRoots = markRoots;
+	string scriptPath = "expressions.pys";
+	SourceFile* source = mapSourceFile(scriptPath);
+	if (dumpTokens) {
+		TokenStream dump(source->view());
+		while (!dump.atEnd()) {
+			cout << dump.next() << endl;
+		}
+		cout << dump.next() << endl;
+	}
+	if (lexOnly) {
+		// The first pass faults the mapped file in and interns every name,
+		// so the timed passes measure the lexer alone. The fastest is kept.
+		stats.lexTokens = countTokens(source->view());
+		for (int pass = 0; pass < 5; pass++) {
+			auto lexStart = chrono::steady_clock::now();
+			countTokens(source->view());
+			double seconds = secondsSince(lexStart);
+			if (pass == 0 || seconds < stats.lexSeconds)
+				stats.lexSeconds = seconds;
+		}
+		stats.lexBytes = source->size;
+		if (showStats)
+			printStats();
+		return 0;
+	}
+	auto frontEndStart = chrono::steady_clock::now();
+	uint64_t sourceHash = hashSource(source->view());
+	Program* program = useCache ? loadProgramCache(cachePathFor(scriptPath), sourceHash) : nullptr;
+	stats.cacheStatus = !useCache ? "disabled" : program != nullptr ? "hit" : "miss";
+	if (program == nullptr) {
+		program = compileProgram(source->view(), parseThreads, lazyParse);
+		if (useCache)
+			writeProgramCache(program, cachePathFor(scriptPath), sourceHash);
+	}
+	if (jit && engine != "tree") {
+		cerr << "Error: --jit runs on the tree engine" << endl;
+		return 1;
+	}
+	stats.frontEndSeconds = secondsSince(frontEndStart);
 	PrintStructData();
-	vector<FunctionDecleration*> funcs = FunctionPass(tokens);
 	AddDefaultFunctions();
 
 	cout << "Printing functions" << endl;
-	for (auto func : funcs) {
+	for (auto func : program->functions) {
 		func->print(0);
 		func->execute();
 	}
-	if (functions.find("main") == functions.end()) {
+	if (!emitCppPath.empty()) {
+		linkProgram(program);
+		typeCheckProgram(program);
+		optimizeProgram(program);
+		emitCpp(program, emitCppPath);
+		return 0;
+	}
+	if (jit)
+		installJit();
+	linkProgram(program);
+	typeCheckProgram(program);
+	optimizeProgram(program);
+	if (engine == "closure")
+		installClosureEngine();
+	if (!functions.contains(SYM_MAIN)) {
 		cerr << "Error: no main function found" << endl;
 		return 1;
 	}
 	cout << "Running main function" << endl;
-	Data* result = functions["main"]->call({});
-	cout << "Result: " << DataToString(*result);
+	auto runStart = chrono::steady_clock::now();
+	Data result;
+	if (engine == "vm")
+		result = vmCallFunction((Function*)functions.get(SYM_MAIN), DataSpan());
+	else
+		functions.get(SYM_MAIN)->call(DataSpan(), result);
+	stats.runSeconds = secondsSince(runStart);
+	cout << "Result: " << DataToString(result);
+	if (showStats) {
+		for (Arena* arena : program->arenas) {
+			stats.arenaAllocations += arena->allocations;
+			stats.arenaBytes += arena->bytes;
+			stats.arenaChunks += arena->chunkCount();
+		}
+		stats.gcLiveBytes = heap.liveBytes;
+		cout << endl;
+		printStats();
+	}
 }
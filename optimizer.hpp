@@ -0,0 +1,230 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <climits>
+#include "parser.hpp"
+using namespace std;
+
+/*
+	AST optimizer, run on every function body after it is linked and before
+	it first executes; --no-optimize turns it off. It
+	- inlines calls to small functions, see inliner.hpp
+	- folds operators whose operands are literals into one Literal, when
+	  applyOperator accepts the types and the result cannot fault at run time
+	- replaces an if with a literal condition by the branch it takes, and
+	  drops a while whose condition is the literal false
+	- drops statements after a return in the same block
+	- splices nested blocks that declare no variables into the block around
+	  them
+	It runs after linking so that a call in code it removes still reports a
+	link error.
+*/
+
+bool optimizeAST = true;
+
+int inlineCalls(Function* caller, Block* body);
+
+// Integer division by zero, and INT_MIN / -1, are left to fault when they run.
+bool canFold(OperatorKind kind, Data left, Data right) {
+	if (operatorResultType(kind, left.type, right.type) == NULL_TYPE)
+		return false;
+	if (left.type == INT && kind == OP_DIVIDE)
+		return right.intValue != 0 && !(right.intValue == -1 && left.intValue == INT_MIN);
+	return true;
+}
+
+int countNodes(Statement* statement);
+
+int countNodes(Expression* expression) {
+	switch (expression->type) {
+	case OPERATOR:
+		return 1 + countNodes(((Operator*)expression)->left) + countNodes(((Operator*)expression)->right);
+	case FUNCTION_CALL: {
+		int count = 1;
+		for (Expression* param : ((FunctionCall*)expression)->params)
+			count += countNodes(param);
+		return count;
+	}
+	case RETURN_BLOCK:
+		return 1 + countNodes(((Return*)expression)->expression);
+	case STATEMENT_WRAPPER:
+		return 1 + countNodes(((StatementWrapper*)expression)->statement);
+	default:
+		return 1;
+	}
+}
+
+int countNodes(Statement* statement) {
+	switch (statement->type) {
+	case BLOCK: {
+		int count = 1;
+		for (Statement* child : ((Block*)statement)->statements)
+			count += countNodes(child);
+		return count;
+	}
+	case ASSIGNMENT:
+		return 1 + countNodes(((Assignment*)statement)->expression);
+	case IF_STATEMENT: {
+		IfStatement* ifStatement = (IfStatement*)statement;
+		return 1 + countNodes(ifStatement->condition) + countNodes(ifStatement->ifBlock) + (ifStatement->elseBlock != nullptr ? countNodes(ifStatement->elseBlock) : 0);
+	}
+	case WHILE_STATEMENT:
+		return 1 + countNodes(((WhileStatement*)statement)->condition) + countNodes(((WhileStatement*)statement)->block);
+	case EXPR_WRAPPER:
+		return 1 + countNodes(((ExpressionWrapper*)statement)->expression);
+	default:
+		return 1;
+	}
+}
+
+int countNodes(ReturnBlock* block) {
+	int count = 1;
+	for (Expression* expression : block->expressions)
+		count += countNodes(expression);
+	return count;
+}
+
+Expression* foldExpression(Expression* expression) {
+	switch (expression->type) {
+	case OPERATOR: {
+		Operator* op = (Operator*)expression;
+		op->left = foldExpression(op->left);
+		op->right = foldExpression(op->right);
+		if (op->left->type != LITERAL || op->right->type != LITERAL)
+			return op;
+		Data left = ((Literal*)op->left)->data;
+		Data right = ((Literal*)op->right)->data;
+		if (!canFold(op->kind, left, right))
+			return op;
+		stats.constantsFolded++;
+		// The literal keeps what the type checker proved about the operator.
+		Literal* literal = arenaNew<Literal>(applyOperator(op->kind, op->op, left, right));
+		literal->staticType = op->staticType;
+		return literal;
+	}
+	case FUNCTION_CALL:
+		for (Expression*& param : ((FunctionCall*)expression)->params)
+			param = foldExpression(param);
+		return expression;
+	case RETURN_BLOCK:
+		((Return*)expression)->expression = foldExpression(((Return*)expression)->expression);
+		return expression;
+	default:
+		return expression;
+	}
+}
+
+bool isLiteralBool(Expression* expression) {
+	return expression->type == LITERAL && ((Literal*)expression)->data.type == BOOL;
+}
+
+bool declaresVariables(Block* block) {
+	for (Statement* statement : block->statements) {
+		if (statement->type == DECLARATION)
+			return true;
+	}
+	return false;
+}
+
+void optimizeBlock(Block* block);
+
+// Appends the optimized form of statement to out, which may be nothing or
+// the statements of a block that is spliced in. Returns false once a return
+// has been appended, since nothing after it in the block can run.
+bool optimizeStatement(Statement* statement, vector<Statement*>& out) {
+	switch (statement->type) {
+	case BLOCK:
+		// A block that declares variables keeps its scope: the slots would
+		// allow splicing it, but the C++ translator declares by name.
+		if (declaresVariables((Block*)statement)) {
+			optimizeBlock((Block*)statement);
+			out.push_back(statement);
+			return !alwaysReturns(statement);
+		}
+		stats.blocksFlattened++;
+		for (Statement* child : ((Block*)statement)->statements) {
+			if (!optimizeStatement(child, out))
+				return false;
+		}
+		return true;
+	case ASSIGNMENT:
+		((Assignment*)statement)->expression = foldExpression(((Assignment*)statement)->expression);
+		break;
+	case IF_STATEMENT: {
+		IfStatement* ifStatement = (IfStatement*)statement;
+		ifStatement->condition = foldExpression(ifStatement->condition);
+		if (isLiteralBool(ifStatement->condition)) {
+			stats.deadBranchesRemoved++;
+			Block* taken = ((Literal*)ifStatement->condition)->data.boolValue ? ifStatement->ifBlock : ifStatement->elseBlock;
+			return taken == nullptr || optimizeStatement(taken, out);
+		}
+		optimizeBlock(ifStatement->ifBlock);
+		if (ifStatement->elseBlock != nullptr) {
+			optimizeBlock(ifStatement->elseBlock);
+			if (ifStatement->elseBlock->statements.empty())
+				ifStatement->elseBlock = nullptr;
+		}
+		break;
+	}
+	case WHILE_STATEMENT: {
+		WhileStatement* whileStatement = (WhileStatement*)statement;
+		whileStatement->condition = foldExpression(whileStatement->condition);
+		if (isLiteralBool(whileStatement->condition) && !((Literal*)whileStatement->condition)->data.boolValue) {
+			stats.deadBranchesRemoved++;
+			return true;
+		}
+		optimizeBlock(whileStatement->block);
+		break;
+	}
+	case EXPR_WRAPPER: {
+		ExpressionWrapper* wrapper = (ExpressionWrapper*)statement;
+		if (wrapper->expression->type == STATEMENT_WRAPPER) {
+			stats.blocksFlattened++;
+			return optimizeStatement(((StatementWrapper*)wrapper->expression)->statement, out);
+		}
+		wrapper->expression = foldExpression(wrapper->expression);
+		out.push_back(wrapper);
+		return wrapper->expression->type != RETURN_BLOCK;
+	}
+	default:
+		break;
+	}
+	out.push_back(statement);
+	return true;
+}
+
+void optimizeBlock(Block* block) {
+	vector<Statement*> statements;
+	for (Statement* statement : block->statements) {
+		if (!optimizeStatement(statement, statements))
+			break;
+	}
+	block->statements = statements;
+}
+
+// Rebuilds the function's ReturnBlock from its optimized statements. The
+// new nodes go to the function's arena.
+void optimizeFunction(Function* function) {
+	if (!optimizeAST || function->block == nullptr)
+		return;
+	ArenaScope scope(function->arena);
+	int before = countNodes(function->block);
+	Block* body = arenaNew<Block>();
+	for (Expression* expression : function->block->expressions) {
+		if (expression->type == STATEMENT_WRAPPER)
+			body->statements.push_back(((StatementWrapper*)expression)->statement);
+		else
+			body->statements.push_back(arenaNew<ExpressionWrapper>(expression));
+	}
+	int inlined = inlineCalls(function, body);
+	optimizeBlock(body);
+	function->block = arenaNew<ReturnBlock>(body);
+	stats.optimizerNodesRemoved += before + inlined - countNodes(function->block);
+}
+
+void optimizeProgram(Program* program) {
+	for (FunctionDecleration* decleration : program->functions) {
+		if (decleration->function != nullptr)
+			optimizeFunction(decleration->function);
+	}
+}
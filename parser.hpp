@@ -5,8 +5,15 @@
 #include <map>
 #include <set>
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <cstdio>
 #include "util.hpp"
 #include "tokenizer.hpp"
+#include "symbols.hpp"
+#include "stats.hpp"
+#include "arena.hpp"
+#include "gc.hpp"
 using namespace std;
 
 /*
@@ -46,25 +53,101 @@ enum DataType {
 int nextDataType = 5;
 
 struct StructData {
-	string name;
-	map<string, DataType> fields;
+	Symbol name;
+	map<Symbol, DataType> fields;
+	// Instance layout: field slotNames[i] of type slotTypes[i] is stored in
+	// slot i of the StructObject.
+	vector<Symbol> slotNames = {};
+	vector<DataType> slotTypes = {};
+
+	// Returns -1 if the struct has no such field.
+	int slotOf(Symbol field) const {
+		for (int i = 0; i < slotNames.size(); i++) {
+			if (slotNames[i] == field)
+				return i;
+		}
+		return -1;
+	}
 };
 
+// A value. Ints, floats and bools are stored inline, so arithmetic never
+// touches the heap; strings, lists and struct instances point at a heap cell
+// through data.
 struct Data {
 	DataType type;
-	void* data;
+	union {
+		int intValue;
+		float floatValue;
+		bool boolValue;
+		void* data;
+	};
+	Data() : type(NULL_TYPE), data(nullptr) {}
+	Data(DataType type, void* data) : type(type), data(data) {}
 };
 
+Data makeInt(int value) {
+	Data d;
+	d.type = INT;
+	d.intValue = value;
+	return d;
+}
+
+Data makeFloat(float value) {
+	Data d;
+	d.type = FLOAT;
+	d.floatValue = value;
+	return d;
+}
+
+Data makeBool(bool value) {
+	Data d;
+	d.type = BOOL;
+	d.boolValue = value;
+	return d;
+}
+
+// Marks the heap object d refers to, if any.
+void markData(Data d);
+
+class StringObject : public GCObject {
+public:
+	string value;
+	StringObject(string value) : value(value) {}
+};
+
+class List : public GCObject {
+public:
+	vector<Data> items;
+	void trace() override {
+		for (Data item : items)
+			markData(item);
+	}
+};
+
+class StructObject : public GCObject {
+public:
+	vector<Data> slots;
+	void trace() override {
+		for (Data slot : slots)
+			markData(slot);
+	}
+};
+
+void markData(Data d) {
+	if ((d.type == STR || d.type >= LIST) && d.data != nullptr)
+		heap.mark((GCObject*)d.data);
+}
+
 string DataToString(Data d) {
 	switch (d.type) {
 	case INT:
-		return to_string(*(int*)d.data);
+		return to_string(d.intValue);
 	case FLOAT:
-		return to_string(*(float*)d.data);
+		return to_string(d.floatValue);
 	case BOOL:
-		return *(bool*)d.data ? "true" : "false";
+		return d.boolValue ? "true" : "false";
 	case STR:
-		return *(string*)d.data;
+		return ((StringObject*)d.data)->value;
 	case LIST:
 		return "List";
 	default:
@@ -72,82 +155,132 @@ string DataToString(Data d) {
 	}
 };
 
-struct List {
-	Data* data;
-	int size;
-};
+// Writes what DataToString returns without building the string.
+void writeData(ostream& out, Data d) {
+	switch (d.type) {
+	case INT:
+		out << d.intValue;
+		break;
+	case FLOAT: {
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "%f", d.floatValue);
+		out << buffer;
+		break;
+	}
+	case STR:
+		out << ((StringObject*)d.data)->value;
+		break;
+	default:
+		out << DataToString(d);
+		break;
+	}
+}
 
-map<string, Data*> variables;
+// Locals of every active call. A call's frame is the contiguous run of
+// frameSize slots starting at frameBase; each parameter and local is read and
+// written at the slot the parser assigned it. The stack may reallocate when a
+// call pushes a frame, so a Data* into it must not be held across a call.
+vector<Data> valueStack;
+size_t frameBase = 0;
+// Set by a return statement until the enclosing function call picks up
+// returnValue; blocks and loops stop executing while it is set.
+bool returning = false;
+Data returnValue;
+// Values that are in flight between evaluate() calls, such as the arguments
+// of a call that is being evaluated. Roots for the collector.
+vector<Data> evaluationStack;
 map<DataType, StructData> structs;
-map<string, DataType> types = {
-	{"int", INT},
-	{"float", FLOAT},
-	{"bool", BOOL},
-	{"str", STR},
-	{"list", LIST},
-};
-
-void addDataType(string name) {
+// Written only while compileProgram sweeps the source and registers structs.
+// Function bodies are parsed afterwards, so the parser's concurrent reads
+// never race with a write.
+SymbolMap<DataType> types(NULL_TYPE, {
+	{SYM_INT, INT},
+	{SYM_FLOAT, FLOAT},
+	{SYM_BOOL, BOOL},
+	{SYM_STR, STR},
+	{SYM_LIST, LIST},
+});
+
+void addDataType(Symbol name) {
 	types[name] = (DataType)nextDataType;
 	nextDataType++;
 }
 
-void setDataType(string name, DataType type) {
+void setDataType(Symbol name, DataType type) {
 	types[name] = type;
 }
 
-Data* createDataFromType(DataType t) {
-	Data* d = new Data();
-	d->type = t;
-	if (t == INT) d->data = new int(0);
-	else if (t == FLOAT) d->data = new float(0.0);
-	else if (t == BOOL) d->data = new bool(false);
-	else if (t == STR) d->data = new string("");
-	else if (t == LIST) d->data = new List();
+void markRoots() {
+	for (Data value : valueStack)
+		markData(value);
+	for (Data value : evaluationStack)
+		markData(value);
+	markData(returnValue);
+}
+
+Data createDataFromType(DataType t) {
+	Data d;
+	if (t == INT) d = makeInt(0);
+	else if (t == FLOAT) d = makeFloat(0.0);
+	else if (t == BOOL) d = makeBool(false);
+	else if (t == STR) d = Data(STR, heap.allocate<StringObject>(""));
+	else if (t == LIST) d = Data(LIST, heap.allocate<List>());
 	else if (t >= nextDataType) {
 		cerr << "Error: invalid data type " << t << endl;
 		exit(1);
 	}
 	else {
-		StructData s = structs[t];
-		map<string, Data*> fields;
-		for (auto field : s.fields) {
-			DataType type = field.second;
-			Data* nullData = new Data{ type, nullptr };
-			fields[field.first] = nullData;
-		}
-		d->data = new map<string, Data*>(fields);
+		const StructData& s = structs[t];
+		StructObject* object = heap.allocate<StructObject>();
+		object->slots.reserve(s.slotTypes.size());
+		for (DataType type : s.slotTypes)
+			object->slots.push_back(Data(type, nullptr));
+		d = Data(t, object);
 	}
 	return d;
 }
 
 class MemberList {
 public:
-	vector<string> members;
-	MemberList(vector<string> members) : members(members) {}
-	MemberList(string str) {
-		members.push_back(str);
+	vector<Symbol> members;
+	// Frame slot of the root variable, assigned by the parser.
+	int slot = -1;
+	// Field slot of each member after the first, for a root of type rootType.
+	DataType rootType = NULL_TYPE;
+	vector<int> slots;
+	MemberList(vector<Symbol> members) : members(members) {}
+	MemberList(Symbol symbol) {
+		members.push_back(symbol);
 	}
 	Data* get() {
 		if (members.size() == 0) {
 			cerr << "Error: invalid member access on empty member list\n";
 			exit(1);
 		}
-		if (variables.find(members[0]) == variables.end()) {
-			cerr << "Error: variable " << members[0] << " not declared\n";
-			exit(1);
-		}
-		Data* current = variables[members[0]];
+		Data* current = &valueStack[frameBase + slot];
+		// Arguments are not checked against parameter types, so a parameter
+		// can hold another type than it was declared with. The field slots are
+		// only used while the root has its static type.
+		bool resolved = current->type == rootType;
 		for (int i = 1; i < members.size(); i++) {
 			DataType currentType = current->type;
-			if (currentType >= LIST) {
-				StructData s = structs[currentType];
-				current = ((map<string, Data*>*)current->data)->at(members[i]);
+			if (currentType > LIST) {
+				StructObject* object = (StructObject*)current->data;
+				if (object == nullptr) {
+					cerr << "Error: member access on uninitialized struct " << getFullName() << endl;
+					exit(1);
+				}
+				int slot = resolved ? slots[i - 1] : structs[currentType].slotOf(members[i]);
+				if (slot < 0) {
+					cerr << "Error: struct " << symbols.name(structs[currentType].name) << " has no field " << symbols.name(members[i]) << endl;
+					exit(1);
+				}
+				current = &object->slots[slot];
 			}
 			else {
 				cerr << "Error: invalid member access on non struct type\n;";
-				cerr << "Member: " << members[0] << " on type: " << currentType << endl;
-				cerr << "Cant access member (" << members[i] << ") on type (" << currentType << ")" << endl;
+				cerr << "Member: " << symbols.name(members[0]) << " on type: " << currentType << endl;
+				cerr << "Cant access member (" << symbols.name(members[i]) << ") on type (" << currentType << ")" << endl;
 				exit(1);
 			}
 		}
@@ -156,8 +289,8 @@ public:
 
 	string getFullName() {
 		string name = "";
-		for (string member : members) {
-			name += member + ".";
+		for (Symbol member : members) {
+			name += symbols.name(member) + ".";
 		}
 		return name;
 	}
@@ -173,97 +306,234 @@ public:
 class Expression: public Node{
 public:
 	ASTNodeType type;
+	// Type every evaluation is known to produce, set by the type checker, or
+	// NULL_TYPE when it is only known at run time.
+	DataType staticType = NULL_TYPE;
 	Expression(ASTNodeType type) : type(type), Node(type) {}
-	virtual Data* evaluate() = 0;
+	virtual Data evaluate() = 0;
+};
+
+enum OperatorKind {
+	OP_ADD,
+	OP_SUBTRACT,
+	OP_MULTIPLY,
+	OP_DIVIDE,
+	OP_GREATER,
+	OP_LESS,
+	OP_EQUAL,
+	OP_NOT_EQUAL,
+	OP_AND,
+	OP_OR,
+	OP_UNKNOWN,
 };
 
+// Spelling of each OperatorKind, indexed by kind.
+const char* operatorSpellings[] = { "+", "-", "*", "/", ">", "<", "==", "!=", "&&", "||", "?" };
+
+OperatorKind decodeOperator(string_view op) {
+	if (op == "+") return OP_ADD;
+	if (op == "-") return OP_SUBTRACT;
+	if (op == "*") return OP_MULTIPLY;
+	if (op == "/") return OP_DIVIDE;
+	if (op == ">") return OP_GREATER;
+	if (op == "<") return OP_LESS;
+	if (op == "==") return OP_EQUAL;
+	if (op == "!=") return OP_NOT_EQUAL;
+	if (op == "&&") return OP_AND;
+	if (op == "||") return OP_OR;
+	return OP_UNKNOWN;
+}
+
+// Applies an operator to any pair of operands; op is its spelling for the
+// error message.
+Data applyOperator(OperatorKind kind, const string& op, Data leftData, Data rightData) {
+	if (leftData.type == INT && rightData.type == INT) {
+		int leftInt = leftData.intValue;
+		int rightInt = rightData.intValue;
+		switch (kind) {
+		case OP_ADD: return makeInt(leftInt + rightInt);
+		case OP_SUBTRACT: return makeInt(leftInt - rightInt);
+		case OP_MULTIPLY: return makeInt(leftInt * rightInt);
+		case OP_DIVIDE: return makeInt(leftInt / rightInt);
+		case OP_GREATER: return makeBool(leftInt > rightInt);
+		case OP_LESS: return makeBool(leftInt < rightInt);
+		case OP_EQUAL: return makeBool(leftInt == rightInt);
+		case OP_NOT_EQUAL: return makeBool(leftInt != rightInt);
+		default: break;
+		}
+	}
+	if (leftData.type == FLOAT && rightData.type == FLOAT) {
+		float leftFloat = leftData.floatValue;
+		float rightFloat = rightData.floatValue;
+		switch (kind) {
+		case OP_ADD: return makeFloat(leftFloat + rightFloat);
+		case OP_SUBTRACT: return makeFloat(leftFloat - rightFloat);
+		case OP_MULTIPLY: return makeFloat(leftFloat * rightFloat);
+		case OP_DIVIDE: return makeFloat(leftFloat / rightFloat);
+		default: break;
+		}
+	}
+	if (leftData.type == BOOL && rightData.type == BOOL) {
+		switch (kind) {
+		case OP_AND: return makeBool(leftData.boolValue && rightData.boolValue);
+		case OP_OR: return makeBool(leftData.boolValue || rightData.boolValue);
+		default: break;
+		}
+	}
+	cerr << "Error: invalid operator " << op << " for types " << leftData.type << " and " << rightData.type << endl;
+	exit(1);
+}
+
+// The result type of an operator for the operand types applyOperator
+// accepts, or NULL_TYPE.
+DataType operatorResultType(OperatorKind kind, DataType left, DataType right) {
+	if (left != right)
+		return NULL_TYPE;
+	bool arithmetic = kind == OP_ADD || kind == OP_SUBTRACT || kind == OP_MULTIPLY || kind == OP_DIVIDE;
+	bool comparison = kind == OP_GREATER || kind == OP_LESS || kind == OP_EQUAL || kind == OP_NOT_EQUAL;
+	if (left == INT && arithmetic)
+		return INT;
+	if (left == INT && comparison)
+		return BOOL;
+	if (left == FLOAT && arithmetic)
+		return FLOAT;
+	if (left == BOOL && (kind == OP_AND || kind == OP_OR))
+		return BOOL;
+	return NULL_TYPE;
+}
+
+/*
+	Operators specialize themselves on the operand types they see. A node
+	starts out unspecialized; its first evaluation looks at the operand types
+	and installs a fast evaluator for that kind and type pair (an int add, a
+	float multiply, ...). Fast evaluators keep a type guard, and when it fails
+	they deoptimize the node to the generic evaluator for good, finishing the
+	current evaluation with the operands already computed. When the type
+	checker has proven both operand types, it installs the evaluator without
+	the guard instead.
+*/
+class Operator;
+
+typedef Data (*OperatorEvaluator)(Operator* node);
+
 class Operator : public Expression {
 public:
 	string op;
+	OperatorKind kind;
 	Expression* left;
 	Expression* right;
-	Operator(string op, Expression* left, Expression* right) : Expression(OPERATOR), op(op), left(left), right(right) {}
-	Data* evaluate() {
-		Data* leftData = left->evaluate();
-		Data* rightData = right->evaluate();
-		if (leftData->type == INT && rightData->type == INT) {
-			int* leftInt = (int*)leftData->data;
-			int* rightInt = (int*)rightData->data;
-			int* result = new int();
-			if (op == "+") {
-				result = new int(*leftInt + *rightInt);
-			}
-			else if (op == "-") {
-				result = new int(*leftInt - *rightInt);
-			}
-			else if (op == "*") {
-				result = new int(*leftInt * *rightInt);
-			}
-			else if (op == "/") {
-				result = new int(*leftInt / *rightInt);
-			}
-			else if (op == ">") {
-				bool* b = new bool(*leftInt > *rightInt);
-				return new Data{ BOOL, b };
-			}
-			else if (op == "<") {
-				bool* b = new bool(*leftInt < *rightInt);
-				return new Data{ BOOL, b };
-			}
-			else if (op == "==") {
-				bool* b = new bool(*leftInt == *rightInt);
-				return new Data{ BOOL, b };
-			}
-			else if (op == "!=") {
-				bool* b = new bool(*leftInt != *rightInt);
-				return new Data{ BOOL, b };
-			}
-			else {
-				cerr << "Error: invalid operator " << op << " for types " << leftData->type << " and " << rightData->type << endl;
-				exit(1);
-			}
-			return new Data{ INT, result };
-		}
-		if (leftData->type == FLOAT && rightData->type == FLOAT) {
-			float* leftFloat = (float*)leftData->data;
-			float* rightFloat = (float*)rightData->data;
-			float* result = new float();
-			if (op == "+") {
-				result = new float(*leftFloat + *rightFloat);
-			}
-			else if (op == "-") {
-				result = new float(*leftFloat - *rightFloat);
-			}
-			else if (op == "*") {
-				result = new float(*leftFloat * *rightFloat);
-			}
-			else if (op == "/") {
-				result = new float(*leftFloat / *rightFloat);
-			}
-			else {
-				cerr << "Error: invalid operator " << op << " for types " << leftData->type << " and " << rightData->type << endl;
-				exit(1);
-			}
-			return new Data{ FLOAT, result };
-		}
-		if (leftData->type == BOOL && rightData->type == BOOL) {
-			bool* leftBool = (bool*)leftData->data;
-			bool* rightBool = (bool*)rightData->data;
-			bool* result = new bool();
-			if (op == "&&") {
-				result = new bool(*leftBool && *rightBool);
+	OperatorEvaluator evaluator;
+	Operator(string op, Expression* left, Expression* right) : Expression(OPERATOR), op(op), kind(decodeOperator(op)), left(left), right(right), evaluator(evaluateUnspecialized) {}
+	Data evaluate() {
+		return evaluator(this);
+	}
+
+	template <OperatorKind K, bool Guard>
+	static Data evaluateInt(Operator* node) {
+		Data leftData = node->left->evaluate();
+		Data rightData = node->right->evaluate();
+		if (Guard && (leftData.type != INT || rightData.type != INT))
+			return node->deoptimize(leftData, rightData);
+		int leftInt = leftData.intValue;
+		int rightInt = rightData.intValue;
+		switch (K) {
+		case OP_ADD: return makeInt(leftInt + rightInt);
+		case OP_SUBTRACT: return makeInt(leftInt - rightInt);
+		case OP_MULTIPLY: return makeInt(leftInt * rightInt);
+		case OP_DIVIDE: return makeInt(leftInt / rightInt);
+		case OP_GREATER: return makeBool(leftInt > rightInt);
+		case OP_LESS: return makeBool(leftInt < rightInt);
+		case OP_EQUAL: return makeBool(leftInt == rightInt);
+		default: return makeBool(leftInt != rightInt);
+		}
+	}
+
+	template <OperatorKind K, bool Guard>
+	static Data evaluateFloat(Operator* node) {
+		Data leftData = node->left->evaluate();
+		Data rightData = node->right->evaluate();
+		if (Guard && (leftData.type != FLOAT || rightData.type != FLOAT))
+			return node->deoptimize(leftData, rightData);
+		float leftFloat = leftData.floatValue;
+		float rightFloat = rightData.floatValue;
+		switch (K) {
+		case OP_ADD: return makeFloat(leftFloat + rightFloat);
+		case OP_SUBTRACT: return makeFloat(leftFloat - rightFloat);
+		case OP_MULTIPLY: return makeFloat(leftFloat * rightFloat);
+		default: return makeFloat(leftFloat / rightFloat);
+		}
+	}
+
+	template <OperatorKind K, bool Guard>
+	static Data evaluateBool(Operator* node) {
+		Data leftData = node->left->evaluate();
+		Data rightData = node->right->evaluate();
+		if (Guard && (leftData.type != BOOL || rightData.type != BOOL))
+			return node->deoptimize(leftData, rightData);
+		if (K == OP_AND)
+			return makeBool(leftData.boolValue && rightData.boolValue);
+		return makeBool(leftData.boolValue || rightData.boolValue);
+	}
+
+	static Data evaluateGeneric(Operator* node) {
+		Data leftData = node->left->evaluate();
+		Data rightData = node->right->evaluate();
+		return node->apply(leftData, rightData);
+	}
+
+	static Data evaluateUnspecialized(Operator* node) {
+		Data leftData = node->left->evaluate();
+		Data rightData = node->right->evaluate();
+		node->evaluator = node->specialize<true>(leftData.type, rightData.type);
+		stats.operatorSpecializations++;
+		return node->apply(leftData, rightData);
+	}
+
+	// Picks the fast evaluator for this operator on the given operand types,
+	// or the generic one if there is none. Guard is false only for types the
+	// type checker has proven.
+	template <bool Guard>
+	OperatorEvaluator specialize(DataType leftType, DataType rightType) {
+		if (leftType == INT && rightType == INT) {
+			switch (kind) {
+			case OP_ADD: return evaluateInt<OP_ADD, Guard>;
+			case OP_SUBTRACT: return evaluateInt<OP_SUBTRACT, Guard>;
+			case OP_MULTIPLY: return evaluateInt<OP_MULTIPLY, Guard>;
+			case OP_DIVIDE: return evaluateInt<OP_DIVIDE, Guard>;
+			case OP_GREATER: return evaluateInt<OP_GREATER, Guard>;
+			case OP_LESS: return evaluateInt<OP_LESS, Guard>;
+			case OP_EQUAL: return evaluateInt<OP_EQUAL, Guard>;
+			case OP_NOT_EQUAL: return evaluateInt<OP_NOT_EQUAL, Guard>;
+			default: break;
 			}
-			else if (op == "||") {
-				result = new bool(*leftBool || *rightBool);
+		}
+		if (leftType == FLOAT && rightType == FLOAT) {
+			switch (kind) {
+			case OP_ADD: return evaluateFloat<OP_ADD, Guard>;
+			case OP_SUBTRACT: return evaluateFloat<OP_SUBTRACT, Guard>;
+			case OP_MULTIPLY: return evaluateFloat<OP_MULTIPLY, Guard>;
+			case OP_DIVIDE: return evaluateFloat<OP_DIVIDE, Guard>;
+			default: break;
 			}
-			else {
-				cerr << "Error: invalid operator " << op << " for types " << leftData->type << " and " << rightData->type << endl;
-				exit(1);
+		}
+		if (leftType == BOOL && rightType == BOOL) {
+			switch (kind) {
+			case OP_AND: return evaluateBool<OP_AND, Guard>;
+			case OP_OR: return evaluateBool<OP_OR, Guard>;
+			default: break;
 			}
-			return new Data{ BOOL, result };
 		}
-		cerr << "Error: invalid operator " << op << " for types " << leftData->type << " and " << rightData->type << endl;
-		exit(1);
+		return evaluateGeneric;
+	}
+
+	Data deoptimize(Data leftData, Data rightData) {
+		evaluator = evaluateGeneric;
+		stats.operatorDeopts++;
+		return apply(leftData, rightData);
+	}
+
+	Data apply(Data leftData, Data rightData) {
+		return applyOperator(kind, op, leftData, rightData);
 	}
 
 	void print(int depth) override {
@@ -277,27 +547,27 @@ public:
 
 class Literal : public Expression {
 public:
-	Data* data;
-	Literal(Data* data) : Expression(LITERAL), data(data) {}
-	Data* evaluate() {
+	Data data;
+	Literal(Data data) : Expression(LITERAL), data(data) {}
+	Data evaluate() {
 		return data;
 	}
 
 	void print(int depth) override {
 		for (int i = 0; i < depth; i++)
 			cout << "  ";
-		switch (data->type) {
+		switch (data.type) {
 			case INT:
-				cout << "Literal: " << *(int*)data->data << endl;
+				cout << "Literal: " << data.intValue << endl;
 				break;
 			case FLOAT:
-				cout << "Literal: " << *(float*)data->data << endl;
+				cout << "Literal: " << data.floatValue << endl;
 				break;
 			case BOOL:
-				cout << "Literal: " << *(bool*)data->data << endl;
+				cout << "Literal: " << data.boolValue << endl;
 				break;
 			case STR:
-				cout << "Literal: " << *(string*)data->data << endl;
+				cout << "Literal: " << ((StringObject*)data.data)->value << endl;
 				break;
 		}
 	}
@@ -314,9 +584,9 @@ class StatementWrapper : public Expression {
 public:
 	Statement* statement;
 	StatementWrapper(Statement* statement) : statement(statement), Expression(STATEMENT_WRAPPER) {}
-	Data* evaluate() {
+	Data evaluate() {
 		statement->execute();
-		return new Data{ NULL_TYPE, nullptr };
+		return Data();
 	}
 
 	void print(int depth) override {
@@ -328,8 +598,10 @@ class Return : public Expression {
 public:
 	Expression* expression;
 	Return(Expression* expression) : expression(expression), Expression(RETURN_BLOCK) {}
-	Data* evaluate() {
-		return expression->evaluate();
+	Data evaluate() {
+		returnValue = expression->evaluate();
+		returning = true;
+		return returnValue;
 	}
 
 	void print(int depth) override {
@@ -344,17 +616,16 @@ class Variable : public Expression {
 public:
 	MemberList members;
 	Variable(MemberList members) : Expression(VARIABLE), members(members) {}
-	Data* evaluate() {
-		Data* data = members.get();
-		return data;
+	Data evaluate() {
+		return *members.get();
 	}
 
 	void print(int depth) override {
 		for (int i = 0; i < depth; i++)
 			cout << "  ";
 		cout << "Variable: ";
-		for (string member : members.members) {
-			cout << member << ".";
+		for (Symbol member : members.members) {
+			cout << symbols.name(member) << ".";
 		}
 		cout << endl;
 	}
@@ -380,6 +651,8 @@ public:
 	void execute() {
 		for (Statement* statement : statements) {
 			statement->execute();
+			if (returning)
+				return;
 		}
 	}
 
@@ -404,18 +677,21 @@ public:
 				expressions.push_back(wrapper->expression);
 			}
 			else {
-				StatementWrapper* wrapper = new StatementWrapper(statement);
+				StatementWrapper* wrapper = arenaNew<StatementWrapper>(statement);
 				expressions.push_back(wrapper);
 			}
 		}
 	}
 
-	Data* evaluate() {
+	Data evaluate() {
 		for (Expression* expression : expressions) {
-			Data* a = expression->evaluate();
-			if (expression->type == RETURN_BLOCK)
-				return a;
+			expression->evaluate();
+			if (returning) {
+				returning = false;
+				return returnValue;
+			}
 		}
+		return Data();
 	}
 
 	void print(int depth) override {
@@ -430,22 +706,22 @@ public:
 
 class Declaration : public Statement {
 public:
-	string identifier;
+	Symbol identifier;
 	DataType type;
-	Declaration(string identifier, DataType type) : identifier(identifier), type(type), Statement(DECLARATION) {}
+	// Frame slot of the variable, or -1 for a struct field.
+	int slot;
+	Declaration(Symbol identifier, DataType type, int slot) : identifier(identifier), type(type), slot(slot), Statement(DECLARATION) {}
+	// Runs every time control reaches the decleration, so a variable declared
+	// in a loop body starts each iteration with a fresh value.
 	void execute() {
-		if (variables.find(identifier) != variables.end()) {
-			cerr << "Decleration::Execute Error: variable " << identifier << " already declared" << endl;
-			exit(1);
-		}
-		Data* data = createDataFromType(type);
-		variables[identifier] = data;
+		Data data = createDataFromType(type);
+		valueStack[frameBase + slot] = data;
 	}
 
 	void print(int depth) override {
 		for (int i = 0; i < depth; i++)
 			cout << "  ";
-		cout << "Declaration: " << identifier << " Type: " << type << endl;
+		cout << "Declaration: " << symbols.name(identifier) << " Type: " << type << endl;
 	}
 };
 
@@ -456,15 +732,18 @@ public:
 	Assignment(MemberList identifier, Expression* expression) : identifier(identifier), expression(expression), Statement(ASSIGNMENT) {
 	}
 	void execute() {
+		// The right hand side runs first. It may reassign the struct holding
+		// the target field and then allocate, which would collect that struct
+		// under a field pointer taken beforehand.
+		Data expressionData = expression->evaluate();
 		Data* data = identifier.get();
-		Data* expressionData = expression->evaluate();
-		if (data->type != expressionData->type) {
-			cerr << "Assignment::Execute Error: expected type " << data->type << " but got " << expressionData->type << endl;
+		if (expression->staticType == NULL_TYPE && data->type != expressionData.type) {
+			cerr << "Assignment::Execute Error: expected type " << data->type << " but got " << expressionData.type << endl;
 			exit(1);
 		}
-		if (data->data != nullptr)
-			delete data->data;
-		data->data = expressionData->data;
+		// A heap payload is shared, not copied, and the old one is not freed:
+		// another variable or a literal in the parse arena may still use it.
+		*data = expressionData;
 	}
 
 	void print(int depth) override {
@@ -474,8 +753,8 @@ public:
 		for(int i = 0; i < depth + 1;i++)
 			cout << "  ";
 		cout << "Identifier: ";
-		for (string member : identifier.members) {
-			cout << member << ".";
+		for (Symbol member : identifier.members) {
+			cout << symbols.name(member) << ".";
 		}
 		cout << endl;
 		expression->print(depth + 1);
@@ -484,109 +763,306 @@ public:
 
 class StructDecleration: public Statement {
 public:
-	string name;
-	map<string, DataType> fields;
-	StructDecleration(string name, map<string, DataType> fields) : name(name), fields(fields), Statement(STRUCT_DECLARATION) {}
+	Symbol name;
+	map<Symbol, DataType> fields;
+	StructDecleration(Symbol name, map<Symbol, DataType> fields) : name(name), fields(fields), Statement(STRUCT_DECLARATION) {}
 	void execute() {
 		StructData data = { name, fields };
+		for (pair<Symbol, DataType> field : fields) {
+			data.slotNames.push_back(field.first);
+			data.slotTypes.push_back(field.second);
+		}
+		structs[types.get(name)] = data;
 	}
 
 	void print(int depth) {
 		for (int i = 0; i < depth; i++)
 			cout << "  ";
-		cout << "Struct Decleration: " << name << endl;
-		for (pair<string, DataType> field : fields) {
+		cout << "Struct Decleration: " << symbols.name(name) << endl;
+		for (pair<Symbol, DataType> field : fields) {
 			for (int i = 0; i < depth + 1; i++)
 				cout << "  ";
-			cout << "Field: " << field.first << " Type: " << field.second << endl;
+			cout << "Field: " << symbols.name(field.first) << " Type: " << field.second << endl;
 		}
 	}
 };
 
 class ParameterList {
 public:
-	vector<pair<string, DataType>> params;
-	ParameterList(vector<pair<string, DataType>> params) : params(params) {};
+	vector<pair<Symbol, DataType>> params;
+	ParameterList(vector<pair<Symbol, DataType>> params) : params(params) {};
 	ParameterList() {}
 	void print() {
 		cout << "Parameter List:" << endl;
-		for (pair<string, DataType> param : params) {
-			cout << "Param: " << param.first << " Type: " << param.second << endl;
+		for (pair<Symbol, DataType> param : params) {
+			cout << "Param: " << symbols.name(param.first) << " Type: " << param.second << endl;
 		}
 	}
 };
 
+class ParseScope;
+
+// Scope of the function body this thread is parsing, or nullptr.
+thread_local ParseScope* currentParseScope = nullptr;
+
+// Lexical scopes of the function being parsed. Every parameter and local
+// gets its own slot in the function's frame; blocks nest, and a name resolves
+// to the innermost decleration in scope. Installs itself as the current scope
+// for its lifetime.
+class ParseScope {
+private:
+	ParseScope* previous;
+	// Names declared in each open block, innermost last.
+	vector<map<Symbol, int>> blocks;
+
+public:
+	// Static type of each frame slot.
+	vector<DataType> slotTypes;
+
+	ParseScope(const ParameterList& list) : previous(currentParseScope) {
+		openBlock();
+		for (pair<Symbol, DataType> param : list.params)
+			declare(param.first, param.second);
+		currentParseScope = this;
+	}
+
+	~ParseScope() {
+		currentParseScope = previous;
+	}
+
+	void openBlock() {
+		blocks.emplace_back();
+	}
+
+	void closeBlock() {
+		blocks.pop_back();
+	}
+
+	int declare(Symbol name, DataType type) {
+		if (blocks.back().count(name)) {
+			cerr << "Error: variable " << symbols.name(name) << " already declared in this scope" << endl;
+			exit(1);
+		}
+		int slot = slotTypes.size();
+		slotTypes.push_back(type);
+		blocks.back()[name] = slot;
+		return slot;
+	}
+
+	// Returns -1 if no variable of that name is in scope.
+	int slotOf(Symbol name) const {
+		for (size_t i = blocks.size(); i > 0; i--) {
+			auto it = blocks[i - 1].find(name);
+			if (it != blocks[i - 1].end())
+				return it->second;
+		}
+		return -1;
+	}
+
+	int frameSize() const {
+		return slotTypes.size();
+	}
+};
+
+class Function;
+
+// Arguments of a call: count values starting at data, on the caller's
+// evaluation stack. That stack may reallocate once the callee evaluates
+// anything, so a callee copies the arguments before it runs code.
+struct DataSpan {
+	const Data* data = nullptr;
+	size_t count = 0;
+
+	DataSpan() {}
+	DataSpan(const Data* data, size_t count) : data(data), count(count) {}
+
+	const Data& operator[](size_t i) const {
+		return data[i];
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	const Data* begin() const {
+		return data;
+	}
+
+	const Data* end() const {
+		return data + count;
+	}
+};
+
 class Callable {
 public:
-	virtual Data* call(vector<Data*> params) = 0;
+	// Runs the callable on args and stores its return value in result, so a
+	// call needs no heap allocation.
+	virtual void call(DataSpan args, Data& result) = 0;
+	// Number of arguments the callable takes, or -1 if it takes any number.
+	virtual int arity() {
+		return -1;
+	}
+	// The script function behind this callable, or nullptr for a builtin.
+	virtual Function* definition() {
+		return nullptr;
+	}
 };
 
+Block* parseBlock(TokenSpan tokens, int& i);
+Block* parseFunctionBody(string_view body, const ParameterList& list, int& frameSize);
+class BytecodeFunction;
+void linkStatement(Statement* statement, Symbol function, int& errors);
+void typeCheckFunction(Function* function);
+void optimizeFunction(Function* function);
+
 class Function : public Callable{
 public:
+	Symbol name;
 	ReturnBlock* block;
+	// Number of frame slots for the parameters and locals.
+	int frameSize;
+	// Source of the body when its parse was deferred to the first call.
+	string_view body;
+	// Arena of the program the function belongs to.
+	Arena* arena;
 	ParameterList list;
 	DataType returnType;
-	Function(Block* block, ParameterList list, DataType returnType) : list(list), returnType(returnType) {
-		this->block = new ReturnBlock(block);
+	// Compiled on the first call under --engine=vm.
+	BytecodeFunction* bytecode = nullptr;
+	Function(Symbol name, Block* block, int frameSize, string_view body, Arena* arena, ParameterList list, DataType returnType) : name(name), frameSize(frameSize), body(body), arena(arena), list(list), returnType(returnType) {
+		this->block = block != nullptr ? arenaNew<ReturnBlock>(block) : nullptr;
 	}
 	Function() {}
-	Data* call(vector<Data*> params) {
-		for (int i = 0; i < params.size(); i++) {
-			variables[list.params[i].first] = params[i];
+	// Pushes a frame whose first slots are the parameters, runs the body and
+	// pops the frame again.
+	void call(DataSpan args, Data& result) {
+		if (block == nullptr)
+			parseBody();
+		size_t base = valueStack.size();
+		valueStack.resize(base + frameSize);
+		for (int i = 0; i < args.size(); i++) {
+			valueStack[base + i] = args[i];
 		}
-		return block->evaluate();
+		size_t callerBase = frameBase;
+		frameBase = base;
+		result = block->evaluate();
+		frameBase = callerBase;
+		valueStack.resize(base);
+	}
+
+	int arity() override {
+		return list.params.size();
+	}
+
+	Function* definition() override {
+		return this;
+	}
+
+	// Runs in the middle of execution, so the front end trace stays quiet. The
+	// program was linked without this body, so its calls are linked here.
+	void parseBody() {
+		auto start = chrono::steady_clock::now();
+		bool trace = traceParser;
+		traceParser = false;
+		ArenaScope scope(arena);
+		Block* parsed = parseFunctionBody(body, list, frameSize);
+		int errors = 0;
+		linkStatement(parsed, name, errors);
+		if (errors > 0)
+			exit(1);
+		block = arenaNew<ReturnBlock>(parsed);
+		typeCheckFunction(this);
+		optimizeFunction(this);
+		traceParser = trace;
+		stats.deferredParses++;
+		stats.functionsParsed++;
+		stats.deferredParseSeconds += secondsSince(start);
 	}
 };
 
-map<string, Callable*> functions;
+SymbolMap<Callable*> functions(nullptr);
 
-void addFunctionName(string name) {
+void addFunctionName(Symbol name) {
 	functions[name] = nullptr;
 }
 
-void addFunction(string name, Function* function) {
+void addFunction(Symbol name, Function* function) {
 	functions[name] = function;
 }
 
 class FunctionDecleration : public Statement {
 public:
-	string name;
+	Symbol name;
+	// nullptr when parsing was deferred; body then holds the source to parse.
 	Block* block;
+	int frameSize;
+	string_view body;
+	Arena* arena;
 	ParameterList list;
 	DataType returnType;
-	FunctionDecleration(string name, Block* block, ParameterList list, DataType returnType) : Statement(FUNCTION_DECLARATION), name(name), block(block), list(list), returnType(returnType) {}
+	// The Function built by execute().
+	Function* function = nullptr;
+	FunctionDecleration(Symbol name, Block* block, int frameSize, string_view body, ParameterList list, DataType returnType) : Statement(FUNCTION_DECLARATION), name(name), block(block), frameSize(frameSize), body(body), arena(currentArena), list(list), returnType(returnType) {}
 	void execute() {
-		Function* function = new Function( block,list, returnType );
+		ArenaScope scope(arena);
+		function = arenaNew<Function>( name, block, frameSize, body, arena, list, returnType );
 		functions[name] = function;
 	}
 
 	void print(int depth) {
 		for (int i = 0; i < depth; i++)
 			cout << "  ";
-		cout << "Function Decleration: " << name << " Return Type: " << returnType << endl;
-		block->print(depth + 1);
-
+		cout << "Function Decleration: " << symbols.name(name) << " Return Type: " << returnType << endl;
+		if (block != nullptr) {
+			block->print(depth + 1);
+		}
+		else {
+			for (int i = 0; i < depth + 1; i++)
+				cout << "  ";
+			cout << "Body: deferred until first call" << endl;
+		}
 	}
 };
 
 class FunctionCall : public Expression {
 public:
-	string functionName;
+	Symbol functionName;
 	vector<Expression*> params;
-	FunctionCall(string functionName, vector<Expression*> params) : Expression(FUNCTION_CALL),functionName(functionName), params(params) {};
-	Data* evaluate() {
-		vector<Data*> paramData;
+	// Bound by linkStatement before the program runs.
+	Callable* callee = nullptr;
+	// Set by the type checker when some argument's type is only known at run
+	// time, so that parameters always hold their declared types.
+	const ParameterList* checkedParams = nullptr;
+	FunctionCall(Symbol functionName, vector<Expression*> params) : Expression(FUNCTION_CALL),functionName(functionName), params(params) {};
+	Data evaluate() {
+		// Arguments stay on the evaluation stack until the call returns, so
+		// a collection while later ones are evaluated cannot free them.
+		size_t base = evaluationStack.size();
 		for (Expression* param : params) {
-			paramData.push_back(param->evaluate());
+			evaluationStack.push_back(param->evaluate());
+		}
+		DataSpan args(evaluationStack.data() + base, params.size());
+		if (checkedParams != nullptr)
+			checkArguments(args);
+		Data result;
+		callee->call(args, result);
+		evaluationStack.resize(base);
+		return result;
+	}
+
+	void checkArguments(DataSpan args) {
+		for (int i = 0; i < args.size(); i++) {
+			if (args[i].type != checkedParams->params[i].second) {
+				cerr << "Error: argument " << i + 1 << " of " << symbols.name(functionName) << " has type " << args[i].type << " but the parameter has type " << checkedParams->params[i].second << endl;
+				exit(1);
+			}
 		}
-		Callable* function = functions[functionName];
-		return function->call(paramData);
 	}
 
 	void print(int depth) {
 		for (int i = 0; i < depth; i++)
 			cout << "  ";
-		cout << "Function Call: " << functionName << " Params:" << endl;
+		cout << "Function Call: " << symbols.name(functionName) << " Params:" << endl;
 		for (Expression* param : params) {
 			param->print(depth + 1);
 		}
@@ -600,13 +1076,12 @@ public:
 	Block* elseBlock;
 	IfStatement(Expression* condition, Block* ifBlock, Block* elseBlock) : Statement(IF_STATEMENT), condition(condition), ifBlock(ifBlock), elseBlock(elseBlock) {}
 	void execute() {
-		Data* conditionData = condition->evaluate();
-		string conditionStr = DataToString(*conditionData);
-		if (conditionData->type != BOOL) {
-			cerr << "Error: expected bool in if statement condition but got " << conditionData->type << endl;
+		Data conditionData = condition->evaluate();
+		if (condition->staticType != BOOL && conditionData.type != BOOL) {
+			cerr << "Error: expected bool in if statement condition but got " << conditionData.type << endl;
 			exit(1);
 		}
-		if (*(bool*)conditionData->data) {
+		if (conditionData.boolValue) {
 			ifBlock->execute();
 		}
 		else {
@@ -632,13 +1107,15 @@ public:
 	Block* block;
 	WhileStatement(Expression* condition, Block* block) : Statement(WHILE_STATEMENT), condition(condition), block(block) {}
 	void execute() override {
-		Data* conditionData = condition->evaluate();
-		if (conditionData->type != BOOL) {
-			cerr << "Error: expected bool in while statement condition but got " << conditionData->type << endl;
+		Data conditionData = condition->evaluate();
+		if (condition->staticType != BOOL && conditionData.type != BOOL) {
+			cerr << "Error: expected bool in while statement condition but got " << conditionData.type << endl;
 			exit(1);
 		}
-		while (*(bool*)conditionData->data) {
+		while (conditionData.boolValue) {
 			block->execute();
+			if (returning)
+				return;
 			conditionData = condition->evaluate();
 		}
 	}
@@ -652,150 +1129,124 @@ public:
 	}
 };
 
-vector<vector<Token>> splitOnTokenType(vector<Token> tokens, TokenType type) {
-	vector<vector<Token>> acc;
-	vector<Token> current;
-	for (Token token : tokens) {
-		if (token.type == type) {
-			acc.push_back(current);
-			current.clear();
-		}
-		else {
-			current.push_back(token);
-		}
-	}
-	acc.push_back(current);
-	return acc;
-};
-
-// Expects tokens[i].type == OPEN_PAR
-ParameterList parseParameterList(vector<Token> tokens, int& i) {
+// Expects tokens[i].type == OPEN_PAR, leaves i on the matching CLOSE_PAR
+ParameterList parseParameterList(TokenSpan tokens, int& i) {
 	if (tokens[i].type != OPEN_PAR) {
 		cerr << "Error: expected open parenthesis when parsing parameterList" << endl;
 		exit(1);
 	}
 
-	vector<Token> acc;
+	vector<pair<Symbol, DataType>> params;
+	int start = i + 1;
 	for (i++; i < tokens.size(); i++) {
-		if (tokens[i].type == CLOSE_PAR) {
-			break;
+		if (tokens[i].type != DELIMITER && tokens[i].type != CLOSE_PAR)
+			continue;
+		int length = i - start;
+		if (length != 0) {
+			if (length != 2) {
+				cerr << "Error: invalid parameter declaration size should be two but is:" << length << endl;
+				exit(1);
+			}
+			const Token& type = tokens[start];
+			const Token& name = tokens[start + 1];
+			if (type.type != IDENTIFIER || name.type != IDENTIFIER) {
+				cerr << "Error: invalid parameter declaration" << endl;
+				exit(1);
+			}
+			if (traceParser)
+				cout << "Param: " << type.value << " Type: " << name.value << endl;
+			params.push_back({ name.symbol, types.get(type.symbol) });
 		}
-		acc.push_back(tokens[i]);
+		if (tokens[i].type == CLOSE_PAR)
+			break;
+		start = i + 1;
 	}
-	vector<pair<string, DataType>> params;
-	vector<vector<Token>> split = splitOnTokenType(acc, DELIMITER);
-	for (vector<Token> param : split) {
-		if (param.size() == 0)
-			continue;
-		if (param.size() != 2) {
-			cerr << "Error: invalid parameter declaration size should be two but is:" << param.size() << endl;
+	ParameterList list(params);
+	if (traceParser)
+		list.print();
+	return list;
+}
+
+// Expects tokens[i].type == IDENTIFIER
+// Resolves a member chain to the frame slot of its root variable and the
+// field slot of each member. Struct layouts are complete by then:
+// compileProgram executes every struct decleration before it parses a
+// function body.
+MemberList resolveMemberList(MemberList list) {
+	if (currentParseScope == nullptr)
+		return list;
+	list.slot = currentParseScope->slotOf(list.members[0]);
+	if (list.slot < 0) {
+		cerr << "Error: variable " << symbols.name(list.members[0]) << " not declared" << endl;
+		exit(1);
+	}
+	DataType rootType = currentParseScope->slotTypes[list.slot];
+	DataType type = rootType;
+	for (int i = 1; i < list.members.size(); i++) {
+		auto it = structs.find(type);
+		if (type <= LIST || it == structs.end()) {
+			cerr << "Error: cannot access member " << symbols.name(list.members[i]) << " of " << list.getFullName() << " on non struct type " << type << endl;
 			exit(1);
 		}
-		if (param[0].type != IDENTIFIER || param[1].type != IDENTIFIER) {
-			cerr << "Error: invalid parameter declaration" << endl;
+		int slot = it->second.slotOf(list.members[i]);
+		if (slot < 0) {
+			cerr << "Error: struct " << symbols.name(it->second.name) << " has no field " << symbols.name(list.members[i]) << endl;
 			exit(1);
 		}
-		cout << "Param: " << param[0].value << " Type: " << param[1].value << endl;
-		params.push_back({ param[1].value, types[param[0].value] });
+		list.slots.push_back(slot);
+		type = it->second.slotTypes[slot];
 	}
-	ParameterList list(params);
-	list.print();
+	list.rootType = rootType;
 	return list;
 }
 
-// Expects tokens[i].type == IDENTIFIER
-MemberList parseMemberList(vector<Token> tokens, int& i) {
+MemberList parseMemberList(TokenSpan tokens, int& i) {
 	if (tokens[i].type != IDENTIFIER) {
 		cerr << "Error: expected identifier when parsing member list\n";
 		cerr << "Given token:" << tokens[i] << endl;
 		exit(1);
 	}
-	vector<string> members;
+	vector<Symbol> members;
 	for (i; i < tokens.size(); i++) {
 		Token token = tokens[i];
 		if (token.type == IDENTIFIER) {
-			members.push_back(token.value);
+			members.push_back(token.symbol);
 			if (i + 1 >= tokens.size())
-				return MemberList(members);
+				return resolveMemberList(MemberList(members));
 			Token next = tokens[++i];
 			if (next.type != MEMBER_ACCESS)
 				break;
 		}
 	}
 	i--;
-	return MemberList(members);
+	return resolveMemberList(MemberList(members));
 }
 
-Block* parse(vector<Token> tokens) {
-	Block* block = new Block();
-	vector<Statement*> statements;
-	int lineNumber = 0;
-	for (int i = 0; i < tokens.size(); i++) {
-		Token token = tokens[i];
-		if (token.type == END_OF_LINE) {
-			lineNumber++;
-			continue;
-		}
-		if (token.type == KEYWORD) {
-			string keyword = token.value;
-			if (keyword == "fun") {
-				Token next = tokens[++i];
-				if (next.type != IDENTIFIER) {
-					cerr << "Error: expected identifier after function decleration on line:" << lineNumber << endl;
-					exit(1);
-				}
-				string functionName = next.value;
-
-			}
-		}
-	}
-}
+Block* parseBlock(TokenSpan tokens, int& i);
 
-Block* parseBlock(vector<Token> tokens, int& i);
-
-Expression* parseExpression(vector<Token> tokens, int& i);
-// Expected first char is OPEN_PAR and parses until matching LAST_PAR
-vector<Expression*> parseExpressionList(vector<Token> tokens, int& i){
+Expression* parseExpression(TokenSpan tokens, int& i);
+// Expects tokens[i].type == OPEN_PAR, leaves i on the matching CLOSE_PAR
+vector<Expression*> parseExpressionList(TokenSpan tokens, int& i){
 	if (tokens[i].type != OPEN_PAR) {
 		cerr << "Error: expected open parenthesis when parsing expression list" << endl;
 		exit(1);
 	}
+	if (traceParser)
+		cout << "Parsing Expression List:" << endl;
+	vector<Expression*> expressions;
 	i++;
-	vector<vector<Token>> split;
-	vector<Token> current;
-	int depth = 1;
-	while (depth > 0) {
-		if (tokens[i].type == OPEN_PAR) {
-			depth++;
-		}
-		if (tokens[i].type == CLOSE_PAR) {
-			depth--;
-			if (depth == 0)
-				break;
-		}
-		if (depth == 1 && tokens[i].type == DELIMITER) {
-			split.push_back(current);
-			current.clear();
-			i++;
-			continue;
+	if (i < tokens.size() && tokens[i].type == CLOSE_PAR)
+		return expressions;
+	while (i < tokens.size()) {
+		expressions.push_back(parseExpression(tokens, i));
+		if (i >= tokens.size() || (tokens[i].type != DELIMITER && tokens[i].type != CLOSE_PAR)) {
+			cerr << "Error: expected , or ) in expression list" << endl;
+			exit(1);
 		}
-		current.push_back(tokens[i]);
+		if (tokens[i].type == CLOSE_PAR)
+			break;
 		i++;
 	}
-	split.push_back(current);
-	cout << "Parsing Expression List:" << endl;
-	cout << "Split size: " << split.size() << endl;
-	for (vector<Token> s : split) {
-		for (Token t : s) {
-			cout << t << endl;
-		}
-		cout << "----" << endl;
-	}
-	vector<Expression*> expressions;
-	for (vector<Token> expression : split) {
-		int k = 0;
-		expressions.push_back(parseExpression(expression, k));
-	}
 	return expressions;
 }
 
@@ -807,14 +1258,16 @@ private:
 public:
 	OperatorHandeler() {};
 	void addExpression(Expression* expr) {
-		cout << "Adding expression: ";
-		expr->print(0);
+		if (traceParser) {
+			cout << "Adding expression: ";
+			expr->print(0);
+		}
 		if (left == nullptr) {
 			left = expr;
 		}
 		else if (right == nullptr && op != "") {
 			right = expr;
-			Operator* oper = new Operator(op, left, right);
+			Operator* oper = arenaNew<Operator>(op, left, right);
 			left = oper;
 			right = nullptr;
 			op = "";
@@ -827,7 +1280,8 @@ public:
 	}
 
 	void addOperator(string op) {
-		cout << "Setting operator: " << op << endl;
+		if (traceParser)
+			cout << "Setting operator: " << op << endl;
 		if (this->op != "") {
 			cerr << "Error: invalid operator handeler state\n";
 			cerr << "Operator added without expression or with two operators" << endl;
@@ -852,69 +1306,60 @@ public:
 	}
 };
 
-Expression* parseExpression(vector<Token> tokens, int& i) {
-	cout << "Parsing Expression" << endl;
+// Stops at the end of the line, before an opening brace, or on a closing
+// parenthesis or delimiter that belongs to an enclosing construct.
+Expression* parseExpression(TokenSpan tokens, int& i) {
+	if (traceParser)
+		cout << "Parsing Expression" << endl;
 	OperatorHandeler handeler;
 	for (; i < tokens.size(); i++) {
-		Token token = tokens[i];
-		std::cout << "parseExpression::Token = " << token << endl;
-		if (token.type == END_OF_LINE) {
+		const Token& token = tokens[i];
+		if (traceParser)
+			std::cout << "parseExpression::Token = " << token << endl;
+		// A closing brace ends the statement on the line before it and is left
+		// for the enclosing parseBlock.
+		if (token.type == END_OF_LINE || token.type == CLOSE_PAR || token.type == DELIMITER || token.type == CLOSE_BRACE) {
 			return handeler.getExpression();
 		}
 		if (token.type == IDENTIFIER) {
-			cout << "parseExpression::Parsing identifier" << endl;
+			if (traceParser)
+				cout << "parseExpression::Parsing identifier" << endl;
 			if (tokens.size() > i + 1 && tokens[i+1].type == OPEN_PAR) {
 				i++;
 				vector<Expression*> params = parseExpressionList(tokens, i);
-				string functionName = token.value;
-				FunctionCall* call = new FunctionCall(functionName, params);
+				FunctionCall* call = arenaNew<FunctionCall>(token.symbol, params);
 				handeler.addExpression(call);
 			}
 			else {
 				MemberList member = parseMemberList(tokens, i);
-				Variable* variable = new Variable(member);
+				Variable* variable = arenaNew<Variable>(member);
 				handeler.addExpression(variable);
 			}
 		}
 		if (token.type == NUMBER) {
-			Data* data = new Data();
-			if (token.value.find(".") != string::npos) {
-				data->type = FLOAT;
-				float* f = new float(stof(token.value));
-				data->data = f;
-			}
-			else {
-				int* j = new int(stoi(token.value));
-				data->data = j;
-			}
-			Literal* literal = new Literal(data);
+			Data data;
+			if (token.value.find(".") != string::npos)
+				data = makeFloat(stof(string(token.value)));
+			else
+				data = makeInt(stoi(string(token.value)));
+			Literal* literal = arenaNew<Literal>(data);
 			handeler.addExpression(literal);
 		}
 		if (token.type == OPEN_PAR) {
-			int depth = 1;
 			i++;
-			vector<Token> acc;
-			while (depth > 0) {
-				if (tokens[i].type == OPEN_PAR) {
-					depth++;
-				}
-				if (tokens[i].type == CLOSE_PAR) {
-					depth--;
-					if (depth == 0)
-						break;
-				}
-				cout << "Adding token: " << tokens[i] << endl;
-				acc.push_back(tokens[i]);
-				i++;
+			Expression* expr = parseExpression(tokens, i);
+			if (i >= tokens.size() || tokens[i].type != CLOSE_PAR) {
+				cerr << "Error: expected close parenthesis in expression" << endl;
+				exit(1);
 			}
-			int k = 0;
-			Expression* expr = parseExpression(acc,k);
 			handeler.addExpression(expr);
-			cout << "Done parsing expression" << endl;
+			if (traceParser)
+				cout << "Done parsing expression" << endl;
 		}
 		if (token.type == OP) {
-			cout << token << endl;
-			handeler.addOperator(token.value);
+			if (traceParser)
+				cout << token << endl;
+			handeler.addOperator(string(token.value));
 		}
 		if (token.type == OPEN_BRACE) {
 			i--;
@@ -924,186 +1369,381 @@ Expression* parseExpression(vector<Token> tokens, int& i) {
 	return handeler.getExpression();
 }
 
-void StructPass(vector<Token> tokens) {
-	int lineNumber = 0;
-	cout << "Starting Struct Pass" << endl;
-	vector<pair<string, int>> dataBlocks;
-	for (int i = 0; i < tokens.size(); i++) {
-		Token token = tokens[i];
-		if (token.type == END_OF_LINE) {
-			lineNumber++;
-			continue;
+// Parses the source of a function body in a scope holding its parameters and
+// sets frameSize to the number of slots its frame needs.
+Block* parseFunctionBody(string_view body, const ParameterList& list, int& frameSize) {
+	ParseScope scope(list);
+	vector<Token> tokens = tokenize(body);
+	int index = 0;
+	Block* block = parseBlock(tokens, index);
+	frameSize = scope.frameSize();
+	return block;
+}
+
+// Binds every call in a function body to its Callable and checks the number
+// of arguments. Each problem is reported and counted in errors, so a whole
+// program can be checked before it exits.
+void linkExpression(Expression* expression, Symbol function, int& errors) {
+	if (expression == nullptr)
+		return;
+	switch (expression->type) {
+	case OPERATOR:
+		linkExpression(((Operator*)expression)->left, function, errors);
+		linkExpression(((Operator*)expression)->right, function, errors);
+		break;
+	case FUNCTION_CALL: {
+		FunctionCall* call = (FunctionCall*)expression;
+		for (Expression* param : call->params)
+			linkExpression(param, function, errors);
+		call->callee = functions.get(call->functionName);
+		if (call->callee == nullptr) {
+			cerr << "Error: call to undefined function " << symbols.name(call->functionName) << " in " << symbols.name(function) << endl;
+			errors++;
 		}
-		if (token.type == KEYWORD) {
-			string keyword = token.value;
-			cout << "Keyword: " << keyword << endl;
-			if (keyword == "struct") {
-				Token next = tokens[++i];
-				if (next.type != IDENTIFIER) {
-					cerr << "Error: expected identifier after struct decleration on line:" << lineNumber << endl;
-					exit(1);
-				}
-				string structName = next.value;
-				next = tokens[++i];
-				if (next.type != OPEN_BRACE) {
-					cerr << "Error: expected open brace after struct name on line:" << lineNumber << endl;
-					exit(1);
-				}
-				dataBlocks.push_back({ structName, i });
-				addDataType(structName);
-			}
-			else {
-				continue;
-			}
+		else if (call->callee->arity() >= 0 && call->callee->arity() != call->params.size()) {
+			cerr << "Error: " << symbols.name(call->functionName) << " takes " << call->callee->arity() << " arguments but is called with " << call->params.size() << " in " << symbols.name(function) << endl;
+			errors++;
 		}
+		break;
+	}
+	case RETURN_BLOCK:
+		linkExpression(((Return*)expression)->expression, function, errors);
+		break;
+	case STATEMENT_WRAPPER:
+		linkStatement(((StatementWrapper*)expression)->statement, function, errors);
+		break;
+	default:
+		break;
 	}
-	cout << "Struct Pass Complete" << endl;
-	cout << "Parsing Struct Data" << endl;
+}
 
-	vector<pair<string, Block*>> blocks;
-	for (pair<string, int> dataBlock : dataBlocks) {
-		string structName = dataBlock.first;
-		int index = dataBlock.second;
-		Block* block = parseBlock(tokens, index);
-		blocks.push_back({ structName, block });
+void linkStatement(Statement* statement, Symbol function, int& errors) {
+	if (statement == nullptr)
+		return;
+	switch (statement->type) {
+	case BLOCK:
+		for (Statement* child : ((Block*)statement)->statements)
+			linkStatement(child, function, errors);
+		break;
+	case ASSIGNMENT:
+		linkExpression(((Assignment*)statement)->expression, function, errors);
+		break;
+	case IF_STATEMENT:
+		linkExpression(((IfStatement*)statement)->condition, function, errors);
+		linkStatement(((IfStatement*)statement)->ifBlock, function, errors);
+		linkStatement(((IfStatement*)statement)->elseBlock, function, errors);
+		break;
+	case WHILE_STATEMENT:
+		linkExpression(((WhileStatement*)statement)->condition, function, errors);
+		linkStatement(((WhileStatement*)statement)->block, function, errors);
+		break;
+	case EXPR_WRAPPER:
+		linkExpression(((ExpressionWrapper*)statement)->expression, function, errors);
+		break;
+	default:
+		break;
 	}
+}
 
-	for (pair<string, Block*> dataBlock : blocks) {
-		string structName = dataBlock.first;
-		Block* block = dataBlock.second;
-		vector<pair<string, DataType>> fields;
-		for (Statement* statement : block->statements) {
-			if (statement->type != DECLARATION) {
-				cerr << "Error: expected decleration in struct block" << endl;
-				exit(1);
-			}
-			Declaration* decleration = (Declaration*)statement;
-			fields.push_back({ decleration->identifier, decleration->type });
+// Everything the front end produced for one script, in source order. The
+// nodes live in the program's arenas (one per parsing thread), so deleting the
+// program releases the whole AST at once.
+class Program {
+public:
+	vector<StructDecleration*> structs;
+	vector<FunctionDecleration*> functions;
+	vector<Arena*> arenas;
+
+	Program() {
+		arenas.push_back(new Arena());
+	}
+
+	~Program() {
+		for (Arena* arena : arenas)
+			delete arena;
+	}
+};
+
+// Links every parsed function body once all functions, including the
+// builtins, are registered. Bodies whose parse was deferred are linked when
+// they are parsed.
+void linkProgram(Program* program) {
+	int errors = 0;
+	for (FunctionDecleration* function : program->functions)
+		linkStatement(function->block, function->name, errors);
+	if (errors > 0) {
+		cerr << errors << " link error(s)" << endl;
+		exit(1);
+	}
+}
+
+// True when every path through the code ends in a return statement.
+bool alwaysReturns(Statement* statement);
+
+bool alwaysReturns(Expression* expression) {
+	if (expression->type == RETURN_BLOCK)
+		return true;
+	return expression->type == STATEMENT_WRAPPER && alwaysReturns(((StatementWrapper*)expression)->statement);
+}
+
+bool alwaysReturns(Statement* statement) {
+	switch (statement->type) {
+	case BLOCK:
+		for (Statement* child : ((Block*)statement)->statements) {
+			if (alwaysReturns(child))
+				return true;
 		}
-		map<string, DataType> fieldsMap;
-		for (pair<string, DataType> field : fields) {
-			fieldsMap[field.first] = field.second;
+		return false;
+	case IF_STATEMENT: {
+		IfStatement* ifStatement = (IfStatement*)statement;
+		return ifStatement->elseBlock != nullptr && alwaysReturns(ifStatement->ifBlock) && alwaysReturns(ifStatement->elseBlock);
+	}
+	case EXPR_WRAPPER:
+		return alwaysReturns(((ExpressionWrapper*)statement)->expression);
+	default:
+		return false;
+	}
+}
+
+bool alwaysReturns(ReturnBlock* block) {
+	for (Expression* expression : block->expressions) {
+		if (alwaysReturns(expression))
+			return true;
+	}
+	return false;
+}
+
+// A struct or function found by the sweep in compileProgram. Its parameter
+// list and body are kept as source text and parsed once every type name in
+// the script is known, which is what lets declarations refer forward.
+struct PendingDecleration {
+	Symbol name = NO_SYMBOL;
+	int lineNumber = 0;
+	string_view params = {};
+	Symbol returnType = NO_SYMBOL;
+	string_view body = {};
+};
+
+StructDecleration* parseStructDecleration(const PendingDecleration& pending) {
+	vector<Token> tokens = tokenize(pending.body);
+	int index = 0;
+	Block* block = parseBlock(tokens, index);
+	map<Symbol, DataType> fields;
+	for (Statement* statement : block->statements) {
+		if (statement->type != DECLARATION) {
+			cerr << "Error: expected decleration in struct block on line:" << pending.lineNumber << endl;
+			exit(1);
 		}
-		StructData data = { structName, fieldsMap };
-		structs[types[structName]] = data;
+		Declaration* decleration = (Declaration*)statement;
+		fields[decleration->identifier] = decleration->type;
 	}
-	cout << "Struct Data Parsed" << endl;
+	return arenaNew<StructDecleration>(pending.name, fields);
 }
 
-vector<FunctionDecleration*> FunctionPass(vector<Token> tokens) {
-	cout << "Parsing functions:" << endl;
-	vector<FunctionDecleration*> functions;
+// With deferBody only the signature is parsed; the body is parsed by
+// Function::call the first time the function runs.
+FunctionDecleration* parseFunctionDecleration(const PendingDecleration& pending, bool deferBody) {
+	vector<Token> paramTokens = tokenize(pending.params);
+	int index = 0;
+	ParameterList list = parseParameterList(paramTokens, index);
+	if (!types.contains(pending.returnType)) {
+		cerr << "Error: unknown return type " << symbols.name(pending.returnType) << " on line:" << pending.lineNumber << endl;
+		exit(1);
+	}
+	DataType returnType = types.get(pending.returnType);
+	if (deferBody)
+		return arenaNew<FunctionDecleration>(pending.name, nullptr, 0, pending.body, list, returnType);
+	int frameSize = 0;
+	Block* block = parseFunctionBody(pending.body, list, frameSize);
+	stats.functionsParsed++;
+	return arenaNew<FunctionDecleration>(pending.name, block, frameSize, pending.body, list, returnType);
+}
+
+// Parses function bodies on a pool of worker threads. Each worker claims the
+// next unparsed body and allocates into its own arena; results are stored by
+// index so they stay in source order.
+vector<FunctionDecleration*> parseFunctionsParallel(Program* program, const vector<PendingDecleration>& pending, int threadCount) {
+	vector<FunctionDecleration*> parsed(pending.size());
+	atomic<size_t> next(0);
+	bool trace = traceParser;
+	traceParser = false;
+	vector<thread> pool;
+	for (int t = 0; t < threadCount; t++) {
+		Arena* arena = new Arena();
+		program->arenas.push_back(arena);
+		pool.emplace_back([&, arena]() {
+			ArenaScope scope(arena);
+			for (size_t k = next++; k < pending.size(); k = next++)
+				parsed[k] = parseFunctionDecleration(pending[k], false);
+		});
+	}
+	for (thread& worker : pool)
+		worker.join();
+	traceParser = trace;
+	return parsed;
+}
+
+// Front end. One sweep over the token stream registers every struct name and
+// records where each struct and function body is; the bodies are then parsed
+// with all type names resolved, on parseThreads threads when it is above one.
+// With deferBodies no body is parsed until its function is first called.
+Program* compileProgram(string_view source, int parseThreads = 1, bool deferBodies = false) {
+	cout << "Compiling program" << endl;
+	TokenStream tokens(source);
+	vector<PendingDecleration> pendingStructs;
+	vector<PendingDecleration> pendingFunctions;
 	int lineNumber = 0;
-	for (int i = 0; i < tokens.size(); i++) {
-		Token token = tokens[i];
+	while (!tokens.atEnd()) {
+		Token token = tokens.next();
 		if (token.type == END_OF_LINE) {
 			lineNumber++;
 			continue;
 		}
-		if (token.type == KEYWORD) {
+		if (token.type != KEYWORD)
+			continue;
+		if (traceParser)
 			cout << "Keyword: " << token.value << endl;
-			string keyword = token.value;
-			if (keyword == "fun") {
-				Token next = tokens[++i];
-				if (next.type != IDENTIFIER) {
-					cerr << "Error: expected identifier after function decleration on line:" << lineNumber << endl;
-					exit(1);
-				}
-				string functionName = next.value;
-				Token nextToken = tokens[++i];
-				if (nextToken.type != OPEN_PAR) {
-					cerr << "Error: expected open parenthesis after function name on line:" << lineNumber << endl;
-					exit(1);
-				}
-				ParameterList list = parseParameterList(tokens, i);
-				nextToken = tokens[++i];
-				if (nextToken.type != OP && nextToken.value != "->") {
-					cerr << "Error: expected -> after parameter list on line:" << lineNumber << endl;
-					exit(1);
-				}
-				nextToken = tokens[++i];
-				if (nextToken.type != IDENTIFIER) {
-					cerr << "Error: expected return type after -> on line:" << lineNumber << endl;
-					exit(1);
-				}
-				string returnType = nextToken.value;
-				DataType type = types[returnType];
-				nextToken = tokens[++i];
-				if (nextToken.type != OPEN_BRACE) {
-					cerr << "Error: expected open brace after return type on line:" << lineNumber << endl;
-					exit(1);
-				}
-				Block* block = parseBlock(tokens, i);
-				FunctionDecleration* function = new FunctionDecleration(functionName, block, list, type);
-				functions.push_back(function);
+		if (token.symbol == SYM_STRUCT) {
+			Token next = tokens.next();
+			if (next.type != IDENTIFIER) {
+				cerr << "Error: expected identifier after struct decleration on line:" << lineNumber << endl;
+				exit(1);
+			}
+			if (tokens.peek().type != OPEN_BRACE) {
+				cerr << "Error: expected open brace after struct name on line:" << lineNumber << endl;
+				exit(1);
+			}
+			PendingDecleration pending = { next.symbol, lineNumber };
+			pending.body = skipBalanced(tokens, OPEN_BRACE, CLOSE_BRACE, lineNumber);
+			pendingStructs.push_back(pending);
+			addDataType(next.symbol);
+		}
+		else if (token.symbol == SYM_FUN) {
+			Token next = tokens.next();
+			if (next.type != IDENTIFIER) {
+				cerr << "Error: expected identifier after function decleration on line:" << lineNumber << endl;
+				exit(1);
+			}
+			if (tokens.peek().type != OPEN_PAR) {
+				cerr << "Error: expected open parenthesis after function name on line:" << lineNumber << endl;
+				exit(1);
+			}
+			PendingDecleration pending = { next.symbol, lineNumber };
+			pending.params = skipBalanced(tokens, OPEN_PAR, CLOSE_PAR, lineNumber);
+			Token nextToken = tokens.next();
+			if (nextToken.type != OP || nextToken.value != "->") {
+				cerr << "Error: expected -> after parameter list on line:" << lineNumber << endl;
+				exit(1);
+			}
+			nextToken = tokens.next();
+			if (nextToken.type != IDENTIFIER) {
+				cerr << "Error: expected return type after -> on line:" << lineNumber << endl;
+				exit(1);
 			}
+			pending.returnType = nextToken.symbol;
+			if (tokens.peek().type != OPEN_BRACE) {
+				cerr << "Error: expected open brace after return type on line:" << lineNumber << endl;
+				exit(1);
+			}
+			pending.body = skipBalanced(tokens, OPEN_BRACE, CLOSE_BRACE, lineNumber);
+			pendingFunctions.push_back(pending);
 		}
 	}
-	cout << "Function Pass Complete" << endl;
-	return functions;
+	cout << "Sweep complete: " << pendingStructs.size() << " structs, " << pendingFunctions.size() << " functions" << endl;
+
+	Program* program = new Program();
+	ArenaScope scope(program->arenas[0]);
+	for (const PendingDecleration& pending : pendingStructs) {
+		StructDecleration* decleration = parseStructDecleration(pending);
+		decleration->execute();
+		program->structs.push_back(decleration);
+	}
+	stats.functionsDeclared += pendingFunctions.size();
+	if (parseThreads > 1 && !deferBodies) {
+		program->functions = parseFunctionsParallel(program, pendingFunctions, parseThreads);
+	}
+	else {
+		for (const PendingDecleration& pending : pendingFunctions)
+			program->functions.push_back(parseFunctionDecleration(pending, deferBodies));
+	}
+	cout << "Program compiled" << endl;
+	return program;
 }
 
-vector<Statement*> parseStatement(vector<Token> t, int& i) {
-	vector<Statement*> statements;
+// Appends the parsed statement(s) to statements and returns with i on the
+// first token after them.
+void parseStatement(TokenSpan t, int& i, vector<Statement*>& statements) {
 	for (;i < t.size(); i++) {
-		Token first = t[i];
-		cout << "parseStatement::Token: " << first << endl;
-		if (t.size() > i + 1)
+		const Token& first = t[i];
+		// The closing brace belongs to the enclosing parseBlock.
+		if (first.type == CLOSE_BRACE)
+			return;
+		if (traceParser)
+			cout << "parseStatement::Token: " << first << endl;
+		if (traceParser && t.size() > i + 1)
 			cout << "parseStatement::Next Token: " << t[i + 1] << endl;
 		if (first.type == IDENTIFIER) {
-			cout << "parseStatment::Parsing identifier" << endl;
-			bool isType = types.find(first.value) != types.end();
+			if (traceParser)
+				cout << "parseStatment::Parsing identifier" << endl;
+			bool isType = types.contains(first.symbol);
 			if (isType) {
-				DataType type = types[first.value];
+				DataType type = types.get(first.symbol);
 				Token next = t[++i];
 				if (next.type != IDENTIFIER) {
 					cerr << "Error: expected identifier after type on line:" << i << endl;
 					exit(1);
 				}
-				string identifier = next.value;
+				Symbol identifier = next.symbol;
 				next = t[++i];
-				Declaration* decleration = new Declaration(identifier, type);
+				int slot = currentParseScope != nullptr ? currentParseScope->declare(identifier, type) : -1;
+				Declaration* decleration = arenaNew<Declaration>(identifier, type, slot);
 				statements.push_back(decleration);
 				if (next.type == END_OF_LINE) {
-					cout << "parseStatement::Returning decleration statement" << endl;
-					return statements;
+					if (traceParser)
+						cout << "parseStatement::Returning decleration statement" << endl;
+					return;
 				}
 				else if (next.type == ASSIGNMENT_OPERATOR) {
-					cout << "parseStatement::Parsing assignment statement" << endl;
-					string op = next.value;
+					if (traceParser)
+						cout << "parseStatement::Parsing assignment statement" << endl;
 					Expression* expression = parseExpression(t, ++i);
-					MemberList member = MemberList(identifier);
-					Assignment* assignment = new Assignment(member, expression);
+					MemberList member = resolveMemberList(MemberList(identifier));
+					Assignment* assignment = arenaNew<Assignment>(member, expression);
 					statements.push_back(assignment);
-					cout << "parseStatemenet::Returning assignment statement" << endl;
+					if (traceParser)
+						cout << "parseStatemenet::Returning assignment statement" << endl;
 				}
 				else {
 					cerr << "Error: expected assignment operator or end of line after decleration\n";
 					cerr << "Instead got: " << next << endl;
 					exit(1);
 				}
-				return statements;
+				return;
+			}
+			// If there is an identifier by itself it must be a function call or assignment
+			else if (t.size() > i + 1 && t[i + 1].type == OPEN_PAR) {
+				if (traceParser)
+					cout << "we must be parsing an expr list\n";
+				/*vector<Expression*> params;
+				while (t[i].type != CLOSE_PAR) {
+					Expression* param = parseExpression(t, i);
+					params.push_back(param);
+				}*/
+				i++;
+				vector<Expression*> params = parseExpressionList(t, i);
+				FunctionCall* call = arenaNew<FunctionCall>(first.symbol, params);
+				ExpressionWrapper* wrapper = arenaNew<ExpressionWrapper>(call);
+				statements.push_back(wrapper);
 			}
 			else {
 				MemberList member = parseMemberList(t, i);
-				// If there is an identifier by itself it must be a function call or assignment
 				Token next = t[++i];
 				if (next.type == ASSIGNMENT_OPERATOR) {
 					Expression* expression = parseExpression(t, ++i);
-					Assignment* assignment = new Assignment(member, expression);
+					Assignment* assignment = arenaNew<Assignment>(member, expression);
 					statements.push_back(assignment);
-				}
-				else if (next.type == OPEN_PAR) {
-					cout << "we must be parsing an expr list\n";
-					/*vector<Expression*> params;
-					while (t[i].type != CLOSE_PAR) {
-						Expression* param = parseExpression(t, i);
-						params.push_back(param);
-					}*/
-					vector<Expression*> params = parseExpressionList(t, i);
-					FunctionCall* call = new FunctionCall(first.value, params);
-					ExpressionWrapper* wrapper = new ExpressionWrapper(call);
-					statements.push_back(wrapper);
+					if (t[i].type == CLOSE_BRACE)
+						return;
 				}
 				else {
 					cerr << "Error: expected assignment operator or open parenthesis after identifier\n";
@@ -1115,14 +1755,14 @@ vector<Statement*> parseStatement(vector<Token> t, int& i) {
 			}
 		}
 		if (first.type == KEYWORD) {
-			if (first.value == "return") {
+			if (first.symbol == SYM_RETURN) {
 				Expression* expression = parseExpression(t, ++i);
-				Return* returnStatement = new Return(expression);
-				ExpressionWrapper* wrapper = new ExpressionWrapper(returnStatement);
+				Return* returnStatement = arenaNew<Return>(expression);
+				ExpressionWrapper* wrapper = arenaNew<ExpressionWrapper>(returnStatement);
 				statements.push_back(wrapper);
-				return statements;
+				return;
 			}
-			if (first.value == "if") {
+			if (first.symbol == SYM_IF) {
 				Token next = t[++i];
 				Expression* condition = parseExpression(t,i);
 				next = t[++i];
@@ -1133,19 +1773,20 @@ vector<Statement*> parseStatement(vector<Token> t, int& i) {
 				Block* ifBlock = parseBlock(t, i);
 				Block* elseBlock = nullptr;
 				next = t[++i];
-				if (next.type == KEYWORD && next.value == "else") {
+				if (next.type == KEYWORD && next.symbol == SYM_ELSE) {
 					next = t[++i];
 					if (next.type != OPEN_BRACE) {
 						cerr << "Error: expected open brace after else" << endl;
 						exit(1);
 					}
 					elseBlock = parseBlock(t, i);
+					i++;
 				}
-				IfStatement* ifStatement = new IfStatement(condition, ifBlock, elseBlock);
+				IfStatement* ifStatement = arenaNew<IfStatement>(condition, ifBlock, elseBlock);
 				statements.push_back(ifStatement);
-				return statements;
+				return;
 			}
-			if (first.value == "while") {
+			if (first.symbol == SYM_WHILE) {
 				Token next = t[++i];
 				Expression* condition = parseExpression(t, i);
 				next = t[++i];
@@ -1154,87 +1795,75 @@ vector<Statement*> parseStatement(vector<Token> t, int& i) {
 					exit(1);
 				}
 				Block* block = parseBlock(t, i);
-				WhileStatement* whileStatement = new WhileStatement(condition, block);
+				i++;
+				WhileStatement* whileStatement = arenaNew<WhileStatement>(condition, block);
 				statements.push_back(whileStatement);
-				return statements;
+				return;
 			}
 		}
 	}
-	return statements;
+	return;
 }
-// Expects tokens[i].type == openBrace
-Block* parseBlock(vector<Token> tokens, int& i) {
-	cout << "Parsing block" << endl;
+// Expects tokens[i].type == OPEN_BRACE, leaves i on the matching CLOSE_BRACE
+Block* parseBlock(TokenSpan tokens, int& i) {
+	if (traceParser)
+		cout << "Parsing block" << endl;
 	if (tokens[i].type != OPEN_BRACE) {
 		cerr << "Error: expected open brace when parsing block" << endl;
 		exit(1);
 	}
 
-	vector<Token> acc;
-	int depth = 1;
-	for (i++; i < tokens.size(); i++) {
-		if (tokens[i].type == OPEN_BRACE) {
-			depth++;
-		}
-		if (tokens[i].type == CLOSE_BRACE) {
-			depth--;
-			if (depth == 0) {
-				break;
-			}
-		}
-		acc.push_back(tokens[i]);
-	}
-
-	vector<Statement*> statements;
-	int j = 0;
-	while (j < acc.size()) {
-		vector<Statement*> statement = parseStatement(acc, j);
-		statements.insert(statements.end(), statement.begin(), statement.end());
+	Block* block = arenaNew<Block>();
+	if (currentParseScope != nullptr)
+		currentParseScope->openBlock();
+	for (i++; i < tokens.size() && tokens[i].type != CLOSE_BRACE;)
+		parseStatement(tokens, i, block->statements);
+	if (currentParseScope != nullptr)
+		currentParseScope->closeBlock();
+	if (i >= tokens.size()) {
+		cerr << "Error: expected close brace when parsing block" << endl;
+		exit(1);
 	}
-	Block* block = new Block();
-	block->statements = statements;
 	return block;
 }
 
 void PrintStructData() {
 	cout << "Printing Struct Data" << endl;
-	for (pair<string, DataType> s : types) {
-		cout << "Struct: " << s.first << endl;
-		StructData data = structs[s.second];
-		for (pair<string, DataType> field : data.fields) {
-			cout << "Field: " << field.first << " Type: " << field.second << endl;
+	for (Symbol s = 0; s < types.size(); s++) {
+		if (!types.contains(s))
+			continue;
+		cout << "Struct: " << symbols.name(s) << endl;
+		StructData data = structs[types.get(s)];
+		for (pair<Symbol, DataType> field : data.fields) {
+			cout << "Field: " << symbols.name(field.first) << " Type: " << field.second << endl;
 		}
 	}
 }
 
 class Print : public Callable {
 public:
-	Data* call(vector<Data*> params) {
-		string str = "";
-		for (Data* param : params) {
-			str += DataToString(*param);
-			str += " ";
+	void call(DataSpan args, Data& result) {
+		for (Data arg : args) {
+			writeData(cout, arg);
+			cout << ' ';
 		}
-		cout << str;
-		return new Data{ NULL_TYPE,nullptr };
+		result = Data();
 	}
 };
 
 class Println : public Callable {
 public:
-	Data* call(vector<Data*> params) {
-		string str = "";
-		for (Data* param : params) {
-			str += DataToString(*param);
-			str += " ";
+	void call(DataSpan args, Data& result) {
+		for (Data arg : args) {
+			writeData(cout, arg);
+			cout << ' ';
 		}
-		cout << str;
 		cout << endl;
-		return new Data{ NULL_TYPE,nullptr };
+		result = Data();
 	}
 };
 
 void AddDefaultFunctions() {
-	functions["print"] = new Print();
-	functions["println"] = new Println();
+	functions[SYM_PRINT] = new Print();
+	functions[SYM_PRINTLN] = new Println();
 }
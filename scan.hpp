@@ -0,0 +1,250 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <cstdint>
+
+#include "util.hpp"
+#if defined(__x86_64__) || defined(_M_X64)
+#define SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+using namespace std;
+
+/*
+	Character class scanners used by the lexer. Each kernel starts at text[i]
+	and returns the index of the first byte at or after i that is outside its
+	class (or inside it, for scanStringEnd), or size if there is none.
+	- identifier: a-z A-Z (isAlpha)
+	- whitespace: space, tab and carriage return (newlines are tokens)
+	- number: 0-9 . - (isNumeric)
+	- string end: the closing " or the end of the line
+*/
+
+typedef size_t (*ScanFunction)(const char* text, size_t i, size_t size);
+
+struct ScanKernels {
+	const char* name;
+	ScanFunction identifier;
+	ScanFunction whitespace;
+	ScanFunction number;
+	ScanFunction stringEnd;
+};
+
+size_t scanIdentifierScalar(const char* text, size_t i, size_t size) {
+	while (i < size && isAlpha(text[i]))
+		i++;
+	return i;
+}
+
+size_t scanWhitespaceScalar(const char* text, size_t i, size_t size) {
+	while (i < size && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r'))
+		i++;
+	return i;
+}
+
+size_t scanNumberScalar(const char* text, size_t i, size_t size) {
+	while (i < size && isNumeric(text[i]))
+		i++;
+	return i;
+}
+
+size_t scanStringEndScalar(const char* text, size_t i, size_t size) {
+	while (i < size && text[i] != '"' && text[i] != '\n')
+		i++;
+	return i;
+}
+
+const ScanKernels scalarKernels = {
+	"scalar", scanIdentifierScalar, scanWhitespaceScalar, scanNumberScalar, scanStringEndScalar,
+};
+
+#ifdef SCAN_X86
+
+static inline unsigned countTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// The SSE2 kernels build a mask of bytes that end the run and jump to the
+// lowest set bit. Bytes >= 0x80 compare as negative and so never match a class.
+
+static inline __m128i sse2InRange(__m128i v, char low, char high) {
+	return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(low - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(high + 1)));
+}
+
+size_t scanIdentifierSSE2(const char* text, size_t i, size_t size) {
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i*)(text + i)), _mm_set1_epi8(0x20));
+		uint32_t stop = ~_mm_movemask_epi8(sse2InRange(v, 'a', 'z')) & 0xFFFF;
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanIdentifierScalar(text, i, size);
+}
+
+size_t scanWhitespaceSSE2(const char* text, size_t i, size_t size) {
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+		__m128i match = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+		uint32_t stop = ~_mm_movemask_epi8(match) & 0xFFFF;
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanWhitespaceScalar(text, i, size);
+}
+
+size_t scanNumberSSE2(const char* text, size_t i, size_t size) {
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+		__m128i match = _mm_or_si128(sse2InRange(v, '0', '9'),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')), _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))));
+		uint32_t stop = ~_mm_movemask_epi8(match) & 0xFFFF;
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanNumberScalar(text, i, size);
+}
+
+size_t scanStringEndSSE2(const char* text, size_t i, size_t size) {
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+		uint32_t stop = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanStringEndScalar(text, i, size);
+}
+
+const ScanKernels sse2Kernels = {
+	"sse2", scanIdentifierSSE2, scanWhitespaceSSE2, scanNumberSSE2, scanStringEndSSE2,
+};
+
+// The AVX2 kernels are the same algorithms 32 bytes at a time. GCC and Clang
+// compile them for AVX2 per function so the rest of the binary stays baseline.
+#if defined(__GNUC__)
+#define SCAN_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define SCAN_AVX2_TARGET
+#endif
+
+SCAN_AVX2_TARGET static inline __m256i avx2InRange(__m256i v, char low, char high) {
+	return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(low - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), v));
+}
+
+SCAN_AVX2_TARGET size_t scanIdentifierAVX2(const char* text, size_t i, size_t size) {
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(text + i)), _mm256_set1_epi8(0x20));
+		uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(avx2InRange(v, 'a', 'z'));
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanIdentifierSSE2(text, i, size);
+}
+
+SCAN_AVX2_TARGET size_t scanWhitespaceAVX2(const char* text, size_t i, size_t size) {
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+		__m256i match = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+		uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(match);
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanWhitespaceSSE2(text, i, size);
+}
+
+SCAN_AVX2_TARGET size_t scanNumberAVX2(const char* text, size_t i, size_t size) {
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+		__m256i match = _mm256_or_si256(avx2InRange(v, '0', '9'),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'))));
+		uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(match);
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanNumberSSE2(text, i, size);
+}
+
+SCAN_AVX2_TARGET size_t scanStringEndAVX2(const char* text, size_t i, size_t size) {
+	for (; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+		uint32_t stop = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+		if (stop)
+			return i + countTrailingZeros(stop);
+	}
+	return scanStringEndSSE2(text, i, size);
+}
+
+const ScanKernels avx2Kernels = {
+	"avx2", scanIdentifierAVX2, scanWhitespaceAVX2, scanNumberAVX2, scanStringEndAVX2,
+};
+
+// What the lexer uses on an AVX2 CPU. AVX2 wins on the long runs of
+// whitespace, number and string text, but measures slower than SSE2 on
+// identifiers, which are mostly shorter than 16 bytes
+// (bench/scan_kernels.sh), so those keep the SSE2 kernel.
+const ScanKernels avx2MixedKernels = {
+	"avx2+sse2", scanIdentifierSSE2, scanWhitespaceAVX2, scanNumberAVX2, scanStringEndAVX2,
+};
+
+bool cpuHasAVX2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+// SSE2 is part of x86-64, so only AVX2 needs a CPU check.
+ScanKernels selectScanKernels() {
+#ifdef SCAN_X86
+	if (cpuHasAVX2())
+		return avx2MixedKernels;
+	return sse2Kernels;
+#else
+	return scalarKernels;
+#endif
+}
+
+ScanKernels scanKernels = selectScanKernels();
+
+// Switches to the kernel set called name, for --scan-kernels. "auto" is the
+// set picked for this CPU. Returns false if there is no such set or this
+// CPU cannot run it.
+bool setScanKernels(const string& name) {
+	if (name == "auto") {
+		scanKernels = selectScanKernels();
+		return true;
+	}
+	if (name == "scalar") {
+		scanKernels = scalarKernels;
+		return true;
+	}
+#ifdef SCAN_X86
+	if (name == "sse2") {
+		scanKernels = sse2Kernels;
+		return true;
+	}
+	if (name == "avx2" && cpuHasAVX2()) {
+		scanKernels = avx2Kernels;
+		return true;
+	}
+#endif
+	return false;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <iostream>
+#include <chrono>
+#include <atomic>
+using namespace std;
+
+// Counters and timings printed by --stats.
+struct Stats {
+	const char* cacheStatus = "disabled";
+	double frontEndSeconds = 0;
+	double runSeconds = 0;
+	size_t lexTokens = 0;
+	size_t lexBytes = 0;
+	double lexSeconds = 0;
+	int functionsDeclared = 0;
+	atomic<int> functionsParsed{0};
+	int deferredParses = 0;
+	double deferredParseSeconds = 0;
+	size_t arenaAllocations = 0;
+	size_t arenaBytes = 0;
+	size_t arenaChunks = 0;
+	size_t operatorSpecializations = 0;
+	size_t operatorDeopts = 0;
+	int optimizerNodesRemoved = 0;
+	int constantsFolded = 0;
+	int deadBranchesRemoved = 0;
+	int blocksFlattened = 0;
+	int callsInlined = 0;
+	int staticTypedExpressions = 0;
+	int runtimeTypedExpressions = 0;
+	int gcCollections = 0;
+	double gcPauseSeconds = 0;
+	double gcMaxPauseSeconds = 0;
+	size_t gcObjectsFreed = 0;
+	size_t gcBytesFreed = 0;
+	size_t gcLiveBytes = 0;
+	int jitCompiled = 0;
+	int jitRejected = 0;
+	size_t jitCodeBytes = 0;
+	size_t jitNativeCalls = 0;
+	size_t jitVerifiedCalls = 0;
+};
+
+Stats stats;
+
+double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void printStats() {
+	cerr << "--- stats ---" << endl;
+	cerr << "program cache:    " << stats.cacheStatus << endl;
+	cerr << "front end:        " << stats.frontEndSeconds * 1000 << " ms" << endl;
+	cerr << "run:              " << stats.runSeconds * 1000 << " ms" << endl;
+	if (stats.lexTokens > 0)
+		cerr << "lexer:            " << stats.lexTokens << " tokens, " << stats.lexBytes << " bytes in " << stats.lexSeconds * 1000 << " ms (" << stats.lexBytes / stats.lexSeconds / 1e6 << " MB/s)" << endl;
+	cerr << "functions:        " << stats.functionsParsed << " of " << stats.functionsDeclared << " bodies parsed" << endl;
+	cerr << "deferred parses:  " << stats.deferredParses << " (" << stats.deferredParseSeconds * 1000 << " ms)" << endl;
+	cerr << "parse arena:      " << stats.arenaAllocations << " objects, " << stats.arenaBytes << " bytes in " << stats.arenaChunks << " chunks" << endl;
+	cerr << "types:            " << stats.staticTypedExpressions << " expressions typed statically, " << stats.runtimeTypedExpressions << " at run time" << endl;
+	cerr << "optimizer:        " << stats.optimizerNodesRemoved << " nodes removed (" << stats.constantsFolded << " constants folded, " << stats.deadBranchesRemoved << " dead branches, " << stats.blocksFlattened << " blocks flattened, " << stats.callsInlined << " calls inlined)" << endl;
+	cerr << "operators:        " << stats.operatorSpecializations << " specialized, " << stats.operatorDeopts << " deoptimized" << endl;
+	cerr << "gc:               " << stats.gcCollections << " collections, " << stats.gcObjectsFreed << " objects (" << stats.gcBytesFreed << " bytes) freed, " << stats.gcLiveBytes << " bytes live" << endl;
+	cerr << "gc pauses:        " << stats.gcPauseSeconds * 1000 << " ms total, " << stats.gcMaxPauseSeconds * 1000 << " ms max" << endl;
+	cerr << "jit:              " << stats.jitCompiled << " compiled (" << stats.jitCodeBytes << " bytes), " << stats.jitRejected << " rejected, " << stats.jitNativeCalls << " native calls, " << stats.jitVerifiedCalls << " verified" << endl;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <initializer_list>
+using namespace std;
+
+// Dense id for a distinct identifier or keyword. Ids are handed out in
+// interning order starting at 0, so they can index plain vectors.
+typedef int Symbol;
+
+const Symbol NO_SYMBOL = -1;
+
+// Names the interpreter itself refers to. The interner is seeded with these in
+// this order, so each enumerator is the symbol of its name.
+enum PredefinedSymbol : Symbol {
+	SYM_IF, SYM_ELSE, SYM_WHILE, SYM_FOR, SYM_RETURN, SYM_FUN, SYM_CLASS, SYM_STRUCT,
+	SYM_INT, SYM_FLOAT, SYM_BOOL, SYM_STR, SYM_LIST,
+	SYM_MAIN, SYM_PRINT, SYM_PRINTLN,
+};
+
+const char* predefinedSymbolNames[] = {
+	"if", "else", "while", "for", "return", "fun", "class", "struct",
+	"int", "float", "bool", "str", "list",
+	"main", "print", "println",
+};
+
+class Interner {
+private:
+	unordered_map<string_view, Symbol> ids;
+	// deque never relocates its elements, so the string_view keys stay valid.
+	deque<string> names;
+
+public:
+	Interner() {
+		for (const char* name : predefinedSymbolNames)
+			intern(name);
+	}
+
+	Symbol intern(string_view name) {
+		auto it = ids.find(name);
+		if (it != ids.end())
+			return it->second;
+		Symbol symbol = (Symbol)names.size();
+		names.emplace_back(name);
+		ids.emplace(string_view(names.back()), symbol);
+		return symbol;
+	}
+
+	// Read-only lookup, safe to call from several threads while nothing is
+	// being interned. Returns NO_SYMBOL for names that were never interned.
+	Symbol find(string_view name) const {
+		auto it = ids.find(name);
+		return it != ids.end() ? it->second : NO_SYMBOL;
+	}
+
+	const string& name(Symbol symbol) const {
+		return names[symbol];
+	}
+
+	size_t size() const {
+		return names.size();
+	}
+};
+
+Interner symbols;
+
+// Table indexed directly by Symbol. Symbols that were never stored read back
+// as the table's missing value.
+template <typename T>
+class SymbolMap {
+private:
+	vector<T> values;
+	T missing;
+
+public:
+	SymbolMap(T missing, initializer_list<pair<Symbol, T>> entries = {}) : missing(missing) {
+		for (const pair<Symbol, T>& entry : entries)
+			(*this)[entry.first] = entry.second;
+	}
+
+	T get(Symbol symbol) const {
+		return symbol >= 0 && (size_t)symbol < values.size() ? values[symbol] : missing;
+	}
+
+	bool contains(Symbol symbol) const {
+		return get(symbol) != missing;
+	}
+
+	T& operator[](Symbol symbol) {
+		if ((size_t)symbol >= values.size())
+			values.resize(symbol + 1, missing);
+		return values[symbol];
+	}
+
+	// One past the highest symbol that has ever been stored.
+	Symbol size() const {
+		return (Symbol)values.size();
+	}
+};
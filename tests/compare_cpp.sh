@@ -0,0 +1,51 @@
+#!/bin/sh
+# Checks the C++ translator against the interpreter. For every NAME.pys in
+# this directory, runs the script on the tree engine, translates it with
+# --emit-cpp and compiles and runs the result. Both must print exactly
+# NAME.out, the output after "Running main function".
+#
+# Usage: tests/compare_cpp.sh INTERPRETER
+# CXX selects the compiler, g++ by default.
+if [ $# -ne 1 ]; then
+	echo "usage: $0 INTERPRETER" >&2
+	exit 2
+fi
+interpreter=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+tests=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+for script in "$tests"/*.pys; do
+	name=$(basename "$script" .pys)
+	cp "$script" "$work/expressions.pys"
+	(cd "$work" && "$interpreter" --no-cache --engine=tree 2>/dev/null) |
+		sed -n '/^Running main function$/,$p' | sed 1d > "$work/tree.txt"
+	if ! cmp -s "$tests/$name.out" "$work/tree.txt"; then
+		echo "FAIL $name: tree engine output differs"
+		diff "$tests/$name.out" "$work/tree.txt" | head -10
+		failed=1
+		continue
+	fi
+	if ! (cd "$work" && "$interpreter" --no-cache --emit-cpp="$work/$name.cpp" > "$work/emit.txt" 2>&1); then
+		echo "FAIL $name: --emit-cpp failed"
+		grep Error "$work/emit.txt"
+		failed=1
+		continue
+	fi
+	# -w: the translation keeps code the script never reaches, such as a
+	# division by zero in a branch that is not taken.
+	if ! ${CXX:-g++} -std=c++17 -O2 -w -o "$work/$name" "$work/$name.cpp"; then
+		echo "FAIL $name: generated C++ does not compile"
+		failed=1
+		continue
+	fi
+	"$work/$name" > "$work/cpp.txt"
+	if ! cmp -s "$tests/$name.out" "$work/cpp.txt"; then
+		echo "FAIL $name: generated C++ output differs"
+		diff "$tests/$name.out" "$work/cpp.txt" | head -10
+		failed=1
+		continue
+	fi
+	echo "ok   $name"
+done
+exit $failed
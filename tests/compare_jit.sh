@@ -0,0 +1,32 @@
+#!/bin/sh
+# Differential test of the JIT against the tree engine. Runs every NAME.pys
+# in this directory with --jit --jit-threshold=1 --jit-verify, so each
+# function is compiled on its first call and every native call from the
+# interpreter is checked against the tree engine. The output must be
+# exactly NAME.out.
+#
+# Usage: tests/compare_jit.sh INTERPRETER
+if [ $# -ne 1 ]; then
+	echo "usage: $0 INTERPRETER" >&2
+	exit 2
+fi
+interpreter=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+tests=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+for script in "$tests"/*.pys; do
+	name=$(basename "$script" .pys)
+	cp "$script" "$work/expressions.pys"
+	(cd "$work" && "$interpreter" --no-cache --jit --jit-threshold=1 --jit-verify 2> "$work/errors.txt") |
+		sed -n '/^Running main function$/,$p' | sed 1d > "$work/jit.txt"
+	if ! cmp -s "$tests/$name.out" "$work/jit.txt"; then
+		echo "FAIL $name: --jit output differs"
+		grep Error "$work/errors.txt"
+		diff "$tests/$name.out" "$work/jit.txt" | head -10
+		failed=1
+		continue
+	fi
+	echo "ok   $name"
+done
+exit $failed
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Checks that every scan kernel set lexes each NAME.pys in this directory
+# into the same token stream as the scalar kernels. Sets this CPU cannot
+# run are skipped.
+#
+# Usage: tests/compare_scan_kernels.sh INTERPRETER
+if [ $# -ne 1 ]; then
+	echo "usage: $0 INTERPRETER" >&2
+	exit 2
+fi
+interpreter=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+tests=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+# A set is supported if the interpreter accepts it on an empty script.
+: > "$work/expressions.pys"
+supported=
+for kernels in auto sse2 avx2; do
+	if (cd "$work" && "$interpreter" --lex-only --scan-kernels=$kernels > /dev/null 2>&1); then
+		supported="$supported $kernels"
+	fi
+done
+echo "comparing against scalar:$supported"
+failed=0
+for script in "$tests"/*.pys; do
+	name=$(basename "$script" .pys)
+	cp "$script" "$work/expressions.pys"
+	(cd "$work" && "$interpreter" --dump-tokens --lex-only --scan-kernels=scalar > "$work/scalar.txt")
+	same=1
+	for kernels in $supported; do
+		(cd "$work" && "$interpreter" --dump-tokens --lex-only --scan-kernels=$kernels > "$work/$kernels.txt")
+		if ! cmp -s "$work/scalar.txt" "$work/$kernels.txt"; then
+			echo "FAIL $name: $kernels tokens differ from scalar"
+			diff "$work/scalar.txt" "$work/$kernels.txt" | head -10
+			same=0
+			failed=1
+		fi
+	done
+	[ $same -eq 1 ] && echo "ok   $name"
+done
+exit $failed
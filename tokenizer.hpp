@@ -8,6 +8,8 @@
 #include <fstream>
 
 #include "util.hpp"
+#include "scan.hpp"
+#include "symbols.hpp"
 using namespace std;
 
 enum TokenType {
@@ -47,9 +49,13 @@ string tokenTypeToString(TokenType type) {
 	return "UNKNOWN";
 }
 
+// value points into the source buffer (empty for END_OF_LINE and END_OF_FILE),
+// so the source must outlive every token produced from it. Identifiers and
+// keywords also carry their interned symbol.
 struct Token {
 	TokenType type;
-	string value;
+	string_view value;
+	Symbol symbol = NO_SYMBOL;
 };
 
 std::ostream& operator<<(std::ostream& os, const Token& obj) {
@@ -57,97 +63,266 @@ std::ostream& operator<<(std::ostream& os, const Token& obj) {
 	os << "Token(" << type << ", " << obj.value << ")";
 	return os;
 }
-vector<string> keywords = {
-	"if", "else", "while", "for", "return", "fun", "class", "struct",
+struct WordEntry {
+	string_view word;
+	TokenType type;
+	// Keywords are predefined symbols, so the lexer never has to intern them.
+	Symbol symbol = NO_SYMBOL;
 };
 
-vector<string> operators = {
-	"+", "-", "*", "/", "%", "==", "!=", ">", "<", ">=", "<=", "&&", 
-	"||", "!", "++", "--","->",
+// Perfect hash over a fixed word list, built at compile time. The constructor
+// searches for multipliers that give every word its own slot, so a lookup is a
+// hash, one slot load and one comparison however many words the table holds.
+template <size_t N, size_t Slots>
+struct PerfectWordTable {
+	WordEntry slots[Slots] = {};
+	unsigned a = 0;
+	unsigned b = 0;
+
+	static constexpr unsigned hash(string_view word, unsigned a, unsigned b) {
+		return ((unsigned char)word[0] * a + (unsigned char)word[word.size() - 1] * b + (unsigned)word.size()) >> 2 & (Slots - 1);
+	}
+
+	constexpr PerfectWordTable(const WordEntry (&entries)[N]) {
+		static_assert((Slots & (Slots - 1)) == 0, "slot count must be a power of two");
+		for (unsigned ta = 1; ta < 64 && a == 0; ta++) {
+			for (unsigned tb = 1; tb < 64; tb++) {
+				bool used[Slots] = {};
+				bool collision = false;
+				for (size_t i = 0; i < N && !collision; i++) {
+					unsigned slot = hash(entries[i].word, ta, tb);
+					collision = used[slot];
+					used[slot] = true;
+				}
+				if (!collision) {
+					a = ta;
+					b = tb;
+					break;
+				}
+			}
+		}
+		for (size_t i = 0; a != 0 && i < N; i++)
+			slots[hash(entries[i].word, a, b)] = entries[i];
+	}
+
+	// Returns word's entry, or nullptr if word is not in the table.
+	constexpr const WordEntry* find(string_view word) const {
+		const WordEntry& entry = slots[hash(word, a, b)];
+		return entry.word == word ? &entry : nullptr;
+	}
+
+	// Returns the table's type for word, or fallback if word is not in the table.
+	constexpr TokenType classify(string_view word, TokenType fallback) const {
+		const WordEntry* entry = find(word);
+		return entry != nullptr ? entry->type : fallback;
+	}
 };
 
-vector<string> assignmentOperators = {
-	"=", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=",
+constexpr WordEntry keywords[] = {
+	{"if", KEYWORD, SYM_IF}, {"else", KEYWORD, SYM_ELSE}, {"while", KEYWORD, SYM_WHILE},
+	{"for", KEYWORD, SYM_FOR}, {"return", KEYWORD, SYM_RETURN}, {"fun", KEYWORD, SYM_FUN},
+	{"class", KEYWORD, SYM_CLASS}, {"struct", KEYWORD, SYM_STRUCT},
 };
 
-vector<Token> tokenize(vector<string> lines) {
-	vector<Token> tokens;
-	for (string line : lines) {
-		for (int i = 0; i < line.size(); i++) {
-			char c = line[i];
+// Two character operators. Single character operators are classified directly
+// in Lexer::next: "=" is an assignment, everything else is an OP.
+constexpr WordEntry operators[] = {
+	{"==", OP}, {"!=", OP}, {">=", OP}, {"<=", OP}, {"&&", OP}, {"||", OP},
+	{"++", OP}, {"--", OP}, {"->", OP},
+	{"+=", ASSIGNMENT_OPERATOR}, {"-=", ASSIGNMENT_OPERATOR}, {"*=", ASSIGNMENT_OPERATOR},
+	{"/=", ASSIGNMENT_OPERATOR}, {"%=", ASSIGNMENT_OPERATOR}, {"&=", ASSIGNMENT_OPERATOR},
+	{"|=", ASSIGNMENT_OPERATOR}, {"^=", ASSIGNMENT_OPERATOR},
+};
+
+constexpr PerfectWordTable<size(keywords), 32> keywordTable(keywords);
+constexpr PerfectWordTable<size(operators), 64> operatorTable(operators);
+static_assert(keywordTable.a != 0, "no perfect hash found for the keyword table");
+static_assert(operatorTable.a != 0, "no perfect hash found for the operator table");
+
+// Produces tokens one at a time from a source buffer. After the last token
+// every call returns END_OF_FILE. A lexer created with intern = false only
+// looks names up, for re-lexing regions whose names are already interned.
+class Lexer {
+private:
+	string_view source;
+	size_t i = 0;
+	bool finished = false;
+	bool intern;
+
+public:
+	Lexer(string_view source, bool intern = true) : source(source), intern(intern) {}
+
+	Token next() {
+		size_t size = source.size();
+		const char* text = source.data();
+		for (; i < size; i++) {
+			char c = text[i];
+			if (c == '\n') {
+				i++;
+				return { END_OF_LINE, "" };
+			}
 			if (isWhiteSpace(c)) {
+				i = scanKernels.whitespace(text, i, size) - 1;
 				continue;
 			}
 			if (c == '.') {
-				tokens.push_back({ MEMBER_ACCESS, "." });
-				continue;
+				return { MEMBER_ACCESS, source.substr(i++, 1) };
 			}
 			if (isAlpha(c)) {
-				string word = "";
-				while (isAlpha(c)) {
-					word += c;
-					c = line[++i];
-				}
-				i--;
-				if (find(keywords.begin(), keywords.end(), word) != keywords.end())
-					tokens.push_back({ KEYWORD, word });
-				else
-					tokens.push_back({ IDENTIFIER, word });
-				continue;
+				size_t start = i;
+				i = scanKernels.identifier(text, i, size);
+				string_view word = source.substr(start, i - start);
+				const WordEntry* keyword = keywordTable.find(word);
+				if (keyword != nullptr)
+					return { KEYWORD, word, keyword->symbol };
+				return { IDENTIFIER, word, intern ? symbols.intern(word) : symbols.find(word) };
 			}
 			if (c == '+' || c == '-' || c == '*' || c == '/' || c == '%' || c == '=' || c == '!' || c == '>' || c == '<') {
-				if (c == '-' && i + 1 < line.size() && isNumeric(line[i + 1])) {}
+				if (c == '-' && i + 1 < size && isNumeric(text[i + 1])) {}
 				else {
-					string op = "";
-					op += c;
-					string op2 = op + line[i + 1];
-					if (find(operators.begin(), operators.end(), op2) != operators.end()) {
-						tokens.push_back({ OP, op2 });
-						i++;
-					}
-					else if (find(assignmentOperators.begin(), assignmentOperators.end(), op2) != assignmentOperators.end()) {
-						tokens.push_back({ ASSIGNMENT_OPERATOR, op2 });
-						i++;
+					string_view op = source.substr(i, 1);
+					string_view op2 = source.substr(i, 2);
+					TokenType pairType = op2.size() == 2 ? operatorTable.classify(op2, END_OF_FILE) : END_OF_FILE;
+					if (pairType != END_OF_FILE) {
+						i += 2;
+						return { pairType, op2 };
 					}
-					else {
-						if (c == '=') tokens.push_back({ ASSIGNMENT_OPERATOR, "=" });
-						else tokens.push_back({ OP, op });
-					}
-					
-					continue;
+					i++;
+					if (c == '=') return { ASSIGNMENT_OPERATOR, "=" };
+					return { OP, op };
 				}
 			}
 			if (isNumeric(c)) {
-				string number = "";
-				while (isNumeric(c)) {
-					number += c;
-					c = line[++i];
-				}
-				i--;
-				tokens.push_back({ NUMBER, number });
-				continue;
+				size_t start = i;
+				i = scanKernels.number(text, i, size);
+				return { NUMBER, source.substr(start, i - start) };
 			}
 			if (c == '"') {
-				string str = "";
-				c = line[++i];
-				while (c != '"') {
-					str += c;
-					c = line[++i];
+				size_t start = ++i;
+				i = scanKernels.stringEnd(text, i, size);
+				if (i >= size || text[i] != '"') {
+					cerr << "Error: unterminated string literal" << endl;
+					exit(1);
 				}
-				tokens.push_back({ STRING, str });
+				i++;
+				return { STRING, source.substr(start, i - 1 - start) };
 			}
-			else if (c == '(') tokens.push_back({ OPEN_PAR, "(" });
-			else if (c == ')') tokens.push_back({ CLOSE_PAR, ")" });
-			else if (c == '{') tokens.push_back({ OPEN_BRACE, "{" });
-			else if (c == '}') tokens.push_back({ CLOSE_BRACE, "}" });
-			else if (c == ',') tokens.push_back({ DELIMITER, "," });
+			else if (c == '(') return { OPEN_PAR, source.substr(i++, 1) };
+			else if (c == ')') return { CLOSE_PAR, source.substr(i++, 1) };
+			else if (c == '{') return { OPEN_BRACE, source.substr(i++, 1) };
+			else if (c == '}') return { CLOSE_BRACE, source.substr(i++, 1) };
+			else if (c == ',') return { DELIMITER, source.substr(i++, 1) };
 		}
-		tokens.push_back({ END_OF_LINE, "" });
+		if (!finished) {
+			finished = true;
+			// A final line without a trailing newline still ends the line.
+			if (size > 0 && text[size - 1] != '\n')
+				return { END_OF_LINE, "" };
+		}
+		return { END_OF_FILE, "" };
 	}
-	tokens.push_back({ END_OF_FILE, "" });
-	return tokens;
+};
+
+// Lexes the whole source and returns the number of tokens, END_OF_FILE
+// included. Used by --lex-only to time the lexer on its own.
+size_t countTokens(string_view source) {
+	Lexer lexer(source);
+	size_t count = 1;
+	while (lexer.next().type != END_OF_FILE)
+		count++;
+	return count;
 }
 
+// Non-owning view of a contiguous run of tokens. The parser passes spans
+// around instead of copying token vectors.
+struct TokenSpan {
+	const Token* tokens = nullptr;
+	size_t count = 0;
+
+	TokenSpan(const Token* tokens, size_t count) : tokens(tokens), count(count) {}
+	TokenSpan(const vector<Token>& tokens) : tokens(tokens.data()), count(tokens.size()) {}
+
+	const Token& operator[](size_t i) const {
+		return tokens[i];
+	}
+
+	size_t size() const {
+		return count;
+	}
+};
+
+// Number of tokens a TokenStream can look ahead. Must be a power of two.
+const size_t TOKEN_LOOKAHEAD = 8;
+
+// Pull-based token source. Tokens are lexed on demand into a small ring
+// buffer, so only the lookahead window is ever held in memory.
+class TokenStream {
+private:
+	Lexer lexer;
+	Token ring[TOKEN_LOOKAHEAD];
+	size_t head = 0;
+	size_t count = 0;
+
+public:
+	TokenStream(string_view source) : lexer(source) {}
 
+	// Returns the token k positions ahead without consuming it.
+	const Token& peek(size_t k = 0) {
+		if (k >= TOKEN_LOOKAHEAD) {
+			cerr << "Error: token lookahead of " << k << " exceeds the stream window" << endl;
+			exit(1);
+		}
+		while (count <= k) {
+			ring[(head + count) & (TOKEN_LOOKAHEAD - 1)] = lexer.next();
+			count++;
+		}
+		return ring[(head + k) & (TOKEN_LOOKAHEAD - 1)];
+	}
 
+	Token next() {
+		Token token = peek();
+		head = (head + 1) & (TOKEN_LOOKAHEAD - 1);
+		count--;
+		return token;
+	}
+
+	bool atEnd() {
+		return peek().type == END_OF_FILE;
+	}
+};
 
+// Consumes the tokens from an opening token through its matching closing
+// token and returns the source text they span, brackets included. Expects
+// peek() to be the opening token. Lines crossed are added to lineNumber.
+string_view skipBalanced(TokenStream& stream, TokenType open, TokenType close, int& lineNumber) {
+	const char* start = stream.peek().value.data();
+	int depth = 0;
+	Token token;
+	do {
+		token = stream.next();
+		if (token.type == END_OF_FILE) {
+			cerr << "Error: unexpected end of file while looking for " << tokenTypeToString(close) << endl;
+			exit(1);
+		}
+		if (token.type == END_OF_LINE)
+			lineNumber++;
+		if (token.type == open)
+			depth++;
+		if (token.type == close)
+			depth--;
+	} while (depth > 0);
+	return string_view(start, token.value.data() + 1 - start);
+}
+
+// Lexes a whole region returned by skipBalanced into one token array for the
+// parser. The stream that skipped the region already interned its names, so
+// this only reads the interner and may run on several threads at once.
+vector<Token> tokenize(string_view source) {
+	vector<Token> tokens;
+	tokens.reserve(source.size() / 4 + 2);
+	Lexer lexer(source, false);
+	do {
+		tokens.push_back(lexer.next());
+	} while (tokens.back().type != END_OF_FILE);
+	return tokens;
+}
@@ -0,0 +1,470 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <algorithm>
+#include "parser.hpp"
+using namespace std;
+
+/*
+	Ahead-of-time translation of a script to C++, written by --emit-cpp=path.
+	The output is a standalone program whose main runs the script's main and
+	prints what the interpreter prints after "Running main function".
+
+	int, float, bool and str become int, float, bool and string. A script
+	struct becomes a C++ struct with one member per field, held through a
+	shared_ptr because struct values are references in the interpreter. The
+	runtime helpers are templates (toString, print, println), so each struct
+	and argument list gets its own instantiation instead of a runtime dispatch.
+
+	Types are checked while emitting: an operator, assignment, argument,
+	condition or return whose types the interpreter would reject at run time
+	is reported and stops the translation, as do lists and functions that can
+	end without a return.
+
+	The interpreter evaluates operands and arguments left to right, which C++
+	does not promise. A call is therefore always stored in a temporary before
+	the statement that uses it, and so is any operand evaluated before a call.
+*/
+
+// Variables made by the inliner are named callee.name.site; they get their
+// own prefix, so they cannot clash with a script identifier.
+string cppName(Symbol symbol, const char* prefix) {
+	string name = symbols.name(symbol);
+	if (name.find('.') == string::npos)
+		return prefix + name;
+	replace(name.begin(), name.end(), '.', '_');
+	return "i_" + name;
+}
+
+string cppLiteral(Data data) {
+	switch (data.type) {
+	case INT:
+		return to_string(data.intValue);
+	case FLOAT: {
+		// Hex keeps every bit of the float.
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "%af", data.floatValue);
+		return buffer;
+	}
+	case BOOL:
+		return data.boolValue ? "true" : "false";
+	case STR: {
+		string out = "string(\"";
+		for (unsigned char c : ((StringObject*)data.data)->value) {
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += c;
+			}
+			else if (c < 0x20 || c >= 0x7F) {
+				char escape[8];
+				snprintf(escape, sizeof(escape), "\\%03o", c);
+				out += escape;
+			}
+			else {
+				out += c;
+			}
+		}
+		return out + "\")";
+	}
+	default:
+		return "";
+	}
+}
+
+const char* cppOperator(OperatorKind kind) {
+	switch (kind) {
+	case OP_ADD: return "+";
+	case OP_SUBTRACT: return "-";
+	case OP_MULTIPLY: return "*";
+	case OP_DIVIDE: return "/";
+	case OP_GREATER: return ">";
+	case OP_LESS: return "<";
+	case OP_EQUAL: return "==";
+	case OP_NOT_EQUAL: return "!=";
+	case OP_AND: return "&&";
+	case OP_OR: return "||";
+	default: return nullptr;
+	}
+}
+
+bool containsCall(Expression* expression) {
+	switch (expression->type) {
+	case FUNCTION_CALL:
+		return true;
+	case OPERATOR:
+		return containsCall(((Operator*)expression)->left) || containsCall(((Operator*)expression)->right);
+	default:
+		return false;
+	}
+}
+
+class CppEmitter {
+private:
+	ostringstream out;
+	int indent = 0;
+	int temporaries = 0;
+	Symbol function;
+	DataType returnType;
+	// Declared type of every variable in scope, innermost block last.
+	vector<map<Symbol, DataType>> scopes;
+
+	[[noreturn]] void fail(const string& message) {
+		cerr << "Error: cannot translate " << symbols.name(function) << " to C++: " << message << endl;
+		exit(1);
+	}
+
+	void line(const string& text) {
+		for (int i = 0; i < indent; i++)
+			out << '\t';
+		out << text << '\n';
+	}
+
+	string cppType(DataType type) {
+		switch (type) {
+		case INT: return "int";
+		case FLOAT: return "float";
+		case BOOL: return "bool";
+		case STR: return "string";
+		case LIST: fail("lists are not supported");
+		default:
+			if (type < 0 || !structs.count(type))
+				fail("unknown type " + to_string(type));
+			return "Ref<" + cppName(structs[type].name, "s_") + ">";
+		}
+	}
+
+	string defaultValue(DataType type) {
+		switch (type) {
+		case INT: return "0";
+		case FLOAT: return "0.0f";
+		case BOOL: return "false";
+		case STR: return "string()";
+		default: return "make_shared<" + cppName(structs[type].name, "s_") + ">()";
+		}
+	}
+
+	void declare(Symbol name, DataType type) {
+		scopes.back()[name] = type;
+	}
+
+	DataType variableType(Symbol name) {
+		for (int i = scopes.size() - 1; i >= 0; i--) {
+			auto found = scopes[i].find(name);
+			if (found != scopes[i].end())
+				return found->second;
+		}
+		fail("variable " + string(symbols.name(name)) + " not declared");
+	}
+
+	string memberChain(const MemberList& members, DataType& type) {
+		type = variableType(members.members[0]);
+		string code = cppName(members.members[0], "v_");
+		for (int i = 1; i < members.members.size(); i++) {
+			Symbol field = members.members[i];
+			auto structData = structs.find(type);
+			if (structData == structs.end() || !structData->second.fields.count(field))
+				fail("no field " + string(symbols.name(field)));
+			code += "->" + cppName(field, "v_");
+			type = structData->second.fields.at(field);
+		}
+		return code;
+	}
+
+	// True when code already names a temporary, which nothing can change.
+	static bool isTemporary(const string& code) {
+		return code.size() > 1 && code[0] == 't' && code.find_first_not_of("0123456789", 1) == string::npos;
+	}
+
+	string temporary(const string& code, DataType type) {
+		string name = "t" + to_string(temporaries++);
+		line(cppType(type) + " " + name + " = " + code + ";");
+		return name;
+	}
+
+	// Emits the arguments of a call and returns them joined. An argument is
+	// stored first when a later one makes a call.
+	string arguments(FunctionCall* call, vector<DataType>& types) {
+		string joined;
+		for (int i = 0; i < call->params.size(); i++) {
+			DataType type;
+			string code = expression(call->params[i], type);
+			bool laterCall = false;
+			for (int j = i + 1; j < call->params.size(); j++)
+				laterCall = laterCall || containsCall(call->params[j]);
+			if (laterCall && call->params[i]->type != LITERAL && !isTemporary(code))
+				code = temporary(code, type);
+			types.push_back(type);
+			joined += (i > 0 ? ", " : "") + code;
+		}
+		return joined;
+	}
+
+	// A call to print or println, or to a script function. Returns the call
+	// without a trailing semicolon.
+	string callCode(FunctionCall* call, DataType& type) {
+		vector<DataType> types;
+		string args = arguments(call, types);
+		if (call->functionName == SYM_PRINT || call->functionName == SYM_PRINTLN) {
+			type = NULL_TYPE;
+			return string(symbols.name(call->functionName)) + "(" + args + ")";
+		}
+		Function* callee = dynamic_cast<Function*>(call->callee);
+		if (callee == nullptr)
+			fail("call to unknown function " + string(symbols.name(call->functionName)));
+		for (int i = 0; i < types.size(); i++) {
+			if (types[i] != callee->list.params[i].second)
+				fail("argument " + to_string(i + 1) + " of " + string(symbols.name(call->functionName)) + " has type " + to_string(types[i]) + " but the parameter has type " + to_string(callee->list.params[i].second));
+		}
+		type = callee->returnType;
+		return cppName(call->functionName, "f_") + "(" + args + ")";
+	}
+
+	string expression(Expression* expression, DataType& type) {
+		switch (expression->type) {
+		case LITERAL: {
+			Data data = ((Literal*)expression)->data;
+			type = data.type;
+			if (type != INT && type != FLOAT && type != BOOL && type != STR)
+				fail("unsupported literal");
+			return cppLiteral(data);
+		}
+		case VARIABLE:
+			return memberChain(((Variable*)expression)->members, type);
+		case OPERATOR: {
+			Operator* op = (Operator*)expression;
+			DataType leftType, rightType;
+			string left = this->expression(op->left, leftType);
+			if (containsCall(op->right) && op->left->type != LITERAL && !isTemporary(left))
+				left = temporary(left, leftType);
+			string right = this->expression(op->right, rightType);
+			type = operatorResultType(op->kind, leftType, rightType);
+			if (type == NULL_TYPE)
+				fail("invalid operator " + op->op + " for types " + to_string(leftType) + " and " + to_string(rightType));
+			return "(" + left + " " + cppOperator(op->kind) + " " + right + ")";
+		}
+		case FUNCTION_CALL: {
+			string call = callCode((FunctionCall*)expression, type);
+			if (type == NULL_TYPE)
+				fail("the result of " + string(symbols.name(((FunctionCall*)expression)->functionName)) + " is used as a value");
+			return temporary(call, type);
+		}
+		default:
+			fail("unsupported expression");
+		}
+	}
+
+	string condition(Expression* condition, const char* statement) {
+		DataType type;
+		string code = expression(condition, type);
+		if (type != BOOL)
+			fail(string("expected bool in ") + statement + " statement condition but got " + to_string(type));
+		return code;
+	}
+
+	void effect(Expression* expression) {
+		if (expression->type == RETURN_BLOCK) {
+			DataType type;
+			string value = this->expression(((Return*)expression)->expression, type);
+			if (type != returnType)
+				fail("returns type " + to_string(type) + " but is declared to return " + to_string(returnType));
+			line("return " + value + ";");
+		}
+		else if (expression->type == STATEMENT_WRAPPER) {
+			statement(((StatementWrapper*)expression)->statement);
+		}
+		else if (expression->type == FUNCTION_CALL) {
+			DataType type;
+			line(callCode((FunctionCall*)expression, type) + ";");
+		}
+		else {
+			DataType type;
+			line("(void)" + this->expression(expression, type) + ";");
+		}
+	}
+
+	void block(Block* block) {
+		scopes.push_back({});
+		indent++;
+		for (Statement* child : block->statements)
+			statement(child);
+		indent--;
+		scopes.pop_back();
+	}
+
+	void statement(Statement* statement) {
+		switch (statement->type) {
+		case BLOCK:
+			line("{");
+			block((Block*)statement);
+			line("}");
+			break;
+		case DECLARATION: {
+			Declaration* decleration = (Declaration*)statement;
+			line(cppType(decleration->type) + " " + cppName(decleration->identifier, "v_") + " = " + defaultValue(decleration->type) + ";");
+			declare(decleration->identifier, decleration->type);
+			break;
+		}
+		case ASSIGNMENT: {
+			Assignment* assignment = (Assignment*)statement;
+			DataType valueType, targetType;
+			string value = expression(assignment->expression, valueType);
+			string target = memberChain(assignment->identifier, targetType);
+			if (valueType != targetType)
+				fail("expected type " + to_string(targetType) + " but got " + to_string(valueType) + " in assignment");
+			line(target + " = " + value + ";");
+			break;
+		}
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			line("if (" + condition(ifStatement->condition, "if") + ") {");
+			block(ifStatement->ifBlock);
+			if (ifStatement->elseBlock != nullptr) {
+				line("}");
+				line("else {");
+				block(ifStatement->elseBlock);
+			}
+			line("}");
+			break;
+		}
+		case WHILE_STATEMENT: {
+			WhileStatement* whileStatement = (WhileStatement*)statement;
+			if (!containsCall(whileStatement->condition)) {
+				line("while (" + condition(whileStatement->condition, "while") + ") {");
+			}
+			else {
+				// The calls in the condition run before every test.
+				line("while (true) {");
+				indent++;
+				line("if (!" + condition(whileStatement->condition, "while") + ")");
+				line("\tbreak;");
+				indent--;
+			}
+			block(whileStatement->block);
+			line("}");
+			break;
+		}
+		case EXPR_WRAPPER:
+			effect(((ExpressionWrapper*)statement)->expression);
+			break;
+		default:
+			fail("unsupported statement");
+		}
+	}
+
+	string signature(Function* function) {
+		string params;
+		for (int i = 0; i < function->list.params.size(); i++) {
+			const pair<Symbol, DataType>& param = function->list.params[i];
+			params += (i > 0 ? ", " : "") + cppType(param.second) + " " + cppName(param.first, "v_");
+		}
+		return cppType(function->returnType) + " " + cppName(function->name, "f_") + "(" + params + ")";
+	}
+
+	void functionBody(Function* function) {
+		this->function = function->name;
+		returnType = function->returnType;
+		temporaries = 0;
+		scopes.assign(1, {});
+		for (const pair<Symbol, DataType>& param : function->list.params)
+			declare(param.first, param.second);
+
+		if (!alwaysReturns(function->block))
+			fail("it can end without returning a value");
+
+		line(signature(function) + " {");
+		indent++;
+		for (Expression* expression : function->block->expressions)
+			effect(expression);
+		indent--;
+		line("}");
+		line("");
+	}
+
+public:
+	string emit(Program* program) {
+		line("// Generated by --emit-cpp. Do not edit.");
+		line("#include <iostream>");
+		line("#include <memory>");
+		line("#include <string>");
+		line("using namespace std;");
+		line("");
+		line("template <typename T> using Ref = shared_ptr<T>;");
+		line("");
+		line("string toString(int value) { return to_string(value); }");
+		line("string toString(float value) { return to_string(value); }");
+		line("string toString(bool value) { return value ? \"true\" : \"false\"; }");
+		line("string toString(const string& value) { return value; }");
+		line("template <typename T> string toString(const Ref<T>&) { return \"Unknown\"; }");
+		line("");
+		line("template <typename... T> void print(const T&... values) {");
+		line("\t((cout << toString(values) << \" \"), ...);");
+		line("}");
+		line("");
+		line("template <typename... T> void println(const T&... values) {");
+		line("\tprint(values...);");
+		line("\tcout << endl;");
+		line("}");
+		line("");
+
+		for (StructDecleration* decleration : program->structs)
+			line("struct " + cppName(decleration->name, "s_") + ";");
+		line("");
+		for (StructDecleration* decleration : program->structs) {
+			function = decleration->name;
+			line("struct " + cppName(decleration->name, "s_") + " {");
+			indent++;
+			// Fields of a new struct start out zero, empty or null, as in
+			// createDataFromType.
+			for (pair<Symbol, DataType> field : decleration->fields) {
+				string initial = field.second == INT || field.second == FLOAT || field.second == BOOL ? " = " + defaultValue(field.second) : "";
+				line(cppType(field.second) + " " + cppName(field.first, "v_") + initial + ";");
+			}
+			indent--;
+			line("};");
+			line("");
+		}
+
+		vector<Function*> translated;
+		for (FunctionDecleration* decleration : program->functions) {
+			Function* function = dynamic_cast<Function*>(functions.get(decleration->name));
+			if (function == nullptr)
+				continue;
+			if (function->block == nullptr)
+				function->parseBody();
+			this->function = function->name;
+			line(signature(function) + ";");
+			translated.push_back(function);
+		}
+		line("");
+		for (Function* function : translated)
+			functionBody(function);
+
+		line("int main() {");
+		line("\tauto result = f_main();");
+		line("\tcout << \"Result: \" << toString(result);");
+		line("\treturn 0;");
+		line("}");
+		return out.str();
+	}
+};
+
+void emitCpp(Program* program, const string& path) {
+	if (!functions.contains(SYM_MAIN)) {
+		cerr << "Error: no main function found" << endl;
+		exit(1);
+	}
+	CppEmitter emitter;
+	string source = emitter.emit(program);
+	ofstream file(path);
+	file << source;
+	if (!file) {
+		cerr << "Error: could not write " << path << endl;
+		exit(1);
+	}
+	cout << "Wrote " << path << endl;
+}
@@ -0,0 +1,257 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include "parser.hpp"
+using namespace std;
+
+/*
+	Static type checker, run on every function body after it is linked and
+	before the optimizer; --no-type-check turns it off. Parameters, locals,
+	struct fields and return types are all declared, so most expressions have
+	a type known before the program runs. The checker reports every operator,
+	assignment, argument, condition and return whose known types the
+	interpreter would reject, and the program does not start if there are
+	any.
+
+	It annotates each expression with its staticType, which lets the tree
+	evaluator drop the run time checks: proven operators get an evaluator
+	without a type guard, and assignments, if and while skip their checks.
+	An expression whose type is only known at run time keeps NULL_TYPE and
+	every check it had. That happens for the result of a builtin, or of a
+	function that can end without returning or whose body is not parsed yet
+	under --lazy-parse. A call that passes such a value checks its arguments
+	against the parameter types when it runs, so parameters always hold
+	their declared types.
+
+	A call has its callee's return type when every path through the callee
+	returns a value of that type. Callees can be recursive, so this is found
+	optimistically: every function that always returns is assumed typed, and
+	functions returning an expression that is not known under that
+	assumption are dropped until nothing changes.
+*/
+
+bool typeCheckAST = true;
+
+// Whether calls to a function are known to produce its declared return type.
+// A function with no entry is not.
+map<Function*, bool> typedResults;
+
+class TypeChecker {
+private:
+	Function* function;
+	// Only the final pass reports errors and writes annotations; the passes
+	// that settle typedResults just look.
+	bool annotate;
+	vector<DataType> slotTypes;
+
+	void error(const string& message) {
+		if (annotate)
+			cerr << "Error: " << message << " in " << symbols.name(function->name) << endl;
+		errors++;
+	}
+
+	void declare(int slot, DataType type) {
+		if (slot >= slotTypes.size())
+			slotTypes.resize(slot + 1, NULL_TYPE);
+		slotTypes[slot] = type;
+	}
+
+	DataType memberType(const MemberList& members) {
+		if (members.slot < 0 || members.slot >= slotTypes.size())
+			return NULL_TYPE;
+		DataType type = slotTypes[members.slot];
+		for (int i = 1; i < members.members.size(); i++) {
+			auto structData = structs.find(type);
+			if (structData == structs.end())
+				return NULL_TYPE;
+			auto field = structData->second.fields.find(members.members[i]);
+			if (field == structData->second.fields.end())
+				return NULL_TYPE;
+			type = field->second;
+		}
+		return type;
+	}
+
+	DataType checkCall(FunctionCall* call) {
+		vector<DataType> types;
+		for (Expression* param : call->params)
+			types.push_back(check(param));
+		Function* callee = call->callee != nullptr ? call->callee->definition() : nullptr;
+		if (callee == nullptr)
+			return NULL_TYPE;
+		bool runtimeTypes = false;
+		for (int i = 0; i < types.size(); i++) {
+			if (types[i] == NULL_TYPE)
+				runtimeTypes = true;
+			else if (types[i] != callee->list.params[i].second)
+				error("argument " + to_string(i + 1) + " of " + string(symbols.name(call->functionName)) + " has type " + to_string(types[i]) + " but the parameter has type " + to_string(callee->list.params[i].second));
+		}
+		if (annotate && runtimeTypes)
+			call->checkedParams = &callee->list;
+		auto typed = typedResults.find(callee);
+		return typed != typedResults.end() && typed->second ? callee->returnType : NULL_TYPE;
+	}
+
+	DataType check(Expression* expression) {
+		DataType type = NULL_TYPE;
+		switch (expression->type) {
+		case LITERAL:
+			type = ((Literal*)expression)->data.type;
+			break;
+		case VARIABLE:
+			type = memberType(((Variable*)expression)->members);
+			break;
+		case OPERATOR: {
+			Operator* op = (Operator*)expression;
+			DataType left = check(op->left);
+			DataType right = check(op->right);
+			if (left == NULL_TYPE || right == NULL_TYPE)
+				break;
+			type = operatorResultType(op->kind, left, right);
+			if (type == NULL_TYPE)
+				error("invalid operator " + op->op + " for types " + to_string(left) + " and " + to_string(right));
+			else if (annotate)
+				op->evaluator = op->specialize<false>(left, right);
+			break;
+		}
+		case FUNCTION_CALL:
+			type = checkCall((FunctionCall*)expression);
+			break;
+		case RETURN_BLOCK: {
+			DataType value = check(((Return*)expression)->expression);
+			if (value == NULL_TYPE) {
+				returnsTyped = false;
+			}
+			else if (value != function->returnType) {
+				error("returns type " + to_string(value) + " but is declared to return " + to_string(function->returnType));
+				returnsTyped = false;
+			}
+			return NULL_TYPE;
+		}
+		case STATEMENT_WRAPPER:
+			check(((StatementWrapper*)expression)->statement);
+			return NULL_TYPE;
+		default:
+			return NULL_TYPE;
+		}
+		if (annotate) {
+			expression->staticType = type;
+			if (type == NULL_TYPE)
+				stats.runtimeTypedExpressions++;
+			else
+				stats.staticTypedExpressions++;
+		}
+		return type;
+	}
+
+	void checkCondition(Expression* condition, const char* statement) {
+		DataType type = check(condition);
+		if (type != NULL_TYPE && type != BOOL)
+			error(string("expected bool in ") + statement + " statement condition but got " + to_string(type));
+	}
+
+	void check(Statement* statement) {
+		switch (statement->type) {
+		case BLOCK:
+			for (Statement* child : ((Block*)statement)->statements)
+				check(child);
+			break;
+		case DECLARATION:
+			declare(((Declaration*)statement)->slot, ((Declaration*)statement)->type);
+			break;
+		case ASSIGNMENT: {
+			Assignment* assignment = (Assignment*)statement;
+			DataType value = check(assignment->expression);
+			DataType target = memberType(assignment->identifier);
+			if (value != NULL_TYPE && target != NULL_TYPE && value != target)
+				error("expected type " + to_string(target) + " but got " + to_string(value) + " in assignment");
+			break;
+		}
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			checkCondition(ifStatement->condition, "if");
+			check(ifStatement->ifBlock);
+			if (ifStatement->elseBlock != nullptr)
+				check(ifStatement->elseBlock);
+			break;
+		}
+		case WHILE_STATEMENT:
+			checkCondition(((WhileStatement*)statement)->condition, "while");
+			check(((WhileStatement*)statement)->block);
+			break;
+		case EXPR_WRAPPER:
+			check(((ExpressionWrapper*)statement)->expression);
+			break;
+		default:
+			break;
+		}
+	}
+
+public:
+	int errors = 0;
+	// False once a return is found whose value's type is not known statically.
+	bool returnsTyped = true;
+
+	TypeChecker(Function* function, bool annotate) : function(function), annotate(annotate) {}
+
+	void run() {
+		for (int i = 0; i < function->list.params.size(); i++)
+			declare(i, function->list.params[i].second);
+		for (Expression* expression : function->block->expressions)
+			check(expression);
+	}
+};
+
+// Drops functions from typedResults until every one left only returns
+// values whose type is known.
+void settleTypedResults(const vector<Function*>& checked) {
+	for (Function* function : checked)
+		typedResults[function] = alwaysReturns(function->block);
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (Function* function : checked) {
+			if (!typedResults[function])
+				continue;
+			TypeChecker checker(function, false);
+			checker.run();
+			if (!checker.returnsTyped) {
+				typedResults[function] = false;
+				changed = true;
+			}
+		}
+	}
+}
+
+void typeCheckFunctions(const vector<Function*>& checked) {
+	settleTypedResults(checked);
+	int errors = 0;
+	for (Function* function : checked) {
+		TypeChecker checker(function, true);
+		checker.run();
+		errors += checker.errors;
+	}
+	if (errors > 0) {
+		cerr << errors << " type error(s)" << endl;
+		exit(1);
+	}
+}
+
+// Checks a body parsed on its first call.
+void typeCheckFunction(Function* function) {
+	if (typeCheckAST && function->block != nullptr)
+		typeCheckFunctions({ function });
+}
+
+void typeCheckProgram(Program* program) {
+	if (!typeCheckAST)
+		return;
+	vector<Function*> checked;
+	for (FunctionDecleration* decleration : program->functions) {
+		if (decleration->function != nullptr && decleration->function->block != nullptr)
+			checked.push_back(decleration->function);
+	}
+	typeCheckFunctions(checked);
+}
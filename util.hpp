@@ -1,27 +1,86 @@
 #pragma once
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <set>
 #include <algorithm>
 #include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 
-vector<string> readLinesFromFile(string filename) {
-	vector<string> lines;
-	ifstream file(filename);
+// Debug trace of the front end. Switched off while function bodies are parsed
+// on several threads, where the interleaved output would be meaningless.
+bool traceParser = true;
+
+// Read-only view of a script. On POSIX systems the file is memory mapped so the
+// tokenizer can hand out string_views that point straight into the mapping.
+// Elsewhere the file is read into a single heap buffer.
+class SourceFile {
+public:
+	const char* data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+
+	string_view view() const {
+		return string_view(data, size);
+	}
+
+	~SourceFile() {
+#ifdef _WIN32
+		delete[] data;
+#else
+		if (mapped)
+			munmap((void*)data, size);
+#endif
+	}
+};
+
+SourceFile* mapSourceFile(string filename, bool required = true) {
+	SourceFile* source = new SourceFile();
+#ifdef _WIN32
+	ifstream file(filename, ios::binary | ios::ate);
 	if (!file.is_open()) {
-		cerr << "Error: could not open file " << filename << endl;
-		return lines;
+		if (required)
+			cerr << "Error: could not open file " << filename << endl;
+		return source;
+	}
+	size_t size = file.tellg();
+	char* buffer = new char[size];
+	file.seekg(0);
+	file.read(buffer, size);
+	source->data = buffer;
+	source->size = size;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		if (required)
+			cerr << "Error: could not open file " << filename << endl;
+		return source;
 	}
-	string line;
-	while (getline(file, line)) {
-		lines.push_back(line);
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+			source->data = (const char*)mapping;
+			source->size = info.st_size;
+			source->mapped = true;
+		}
+		else {
+			cerr << "Error: could not map file " << filename << endl;
+		}
 	}
-	file.close();
-	return lines;
+	close(fd);
+#endif
+	return source;
 }
 
 bool isWhiteSpace(char c) {
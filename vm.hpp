@@ -0,0 +1,466 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "parser.hpp"
+using namespace std;
+
+/*
+	Register bytecode engine, selected with --engine=vm. Each Function is
+	compiled from its AST on its first call and then runs in vmRun instead of
+	through evaluate() and execute().
+
+	A call's registers are its frame on valueStack: the parameters and locals
+	keep the slots the parser gave them, and the compiler adds temporaries
+	after them. Instructions are three-address: a is the destination (or the
+	register being tested or stored), b and c are sources, constant or side
+	table indices, or a jump target.
+*/
+
+#define VM_OPCODES(X) \
+	X(VM_LOAD_CONST)    /* r[a] = constants[b] */ \
+	X(VM_MOVE)          /* r[a] = r[b] */ \
+	X(VM_STORE)         /* r[a] = r[b], which must have r[a]'s type */ \
+	X(VM_DECLARE)       /* r[a] = new value of type b */ \
+	X(VM_LOAD_MEMBER)   /* r[a] = member chain b */ \
+	X(VM_STORE_MEMBER)  /* member chain a = r[b], of the member's type */ \
+	X(VM_ADD)           /* r[a] = r[b] op r[c] */ \
+	X(VM_SUBTRACT) \
+	X(VM_MULTIPLY) \
+	X(VM_DIVIDE) \
+	X(VM_GREATER) \
+	X(VM_LESS) \
+	X(VM_EQUAL) \
+	X(VM_NOT_EQUAL) \
+	X(VM_AND) \
+	X(VM_OR) \
+	X(VM_INVALID_OP)    /* fails with operator names[a] on r[b] and r[c] */ \
+	X(VM_JUMP)          /* continue at b */ \
+	X(VM_JUMP_IF_FALSE) /* continue at b unless r[a]; c is 1 in a while loop */ \
+	X(VM_CALL)          /* r[a] = call site b with arguments from r[c] on */ \
+	X(VM_RETURN)        /* return r[a] */ \
+	X(VM_RETURN_NULL)
+
+enum Opcode : uint16_t {
+#define VM_ENUM(name) name,
+	VM_OPCODES(VM_ENUM)
+#undef VM_ENUM
+};
+
+struct Instruction {
+	uint16_t opcode;
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+};
+
+// A call instruction's target: a script function, which runs on the VM, or a
+// builtin, which is called with a span over its arguments on the value stack.
+struct CallSite {
+	Function* function;
+	Callable* callable;
+	int argumentCount;
+	// Checks arguments whose types are only known at run time, see
+	// FunctionCall::checkedParams.
+	FunctionCall* call;
+};
+
+class BytecodeFunction {
+public:
+	vector<Instruction> code;
+	vector<Data> constants;
+	vector<MemberList*> members;
+	vector<CallSite> calls;
+	vector<string> names;
+	int registerCount = 0;
+};
+
+const int VM_MAX_OPERAND = 0xFFFF;
+
+class BytecodeCompiler {
+private:
+	Function* function;
+	BytecodeFunction* out;
+	int nextRegister;
+
+	uint16_t operand(int value) {
+		if (value < 0 || value > VM_MAX_OPERAND) {
+			cerr << "Error: function " << symbols.name(function->name) << " is too large for the bytecode engine" << endl;
+			exit(1);
+		}
+		return (uint16_t)value;
+	}
+
+	int emit(Opcode opcode, int a = 0, int b = 0, int c = 0) {
+		out->code.push_back({ opcode, operand(a), operand(b), operand(c) });
+		return out->code.size() - 1;
+	}
+
+	int here() {
+		return out->code.size();
+	}
+
+	void patchJump(int jump, int target) {
+		out->code[jump].b = operand(target);
+	}
+
+	int allocateRegister() {
+		int reg = nextRegister++;
+		if (nextRegister > out->registerCount)
+			out->registerCount = nextRegister;
+		return operand(reg);
+	}
+
+	// Returns the register a simple variable lives in, or -1.
+	int variableRegister(Expression* expression) {
+		if (expression->type != VARIABLE)
+			return -1;
+		MemberList& members = ((Variable*)expression)->members;
+		return members.members.size() == 1 ? members.slot : -1;
+	}
+
+	int memberIndex(MemberList* members) {
+		out->members.push_back(members);
+		return out->members.size() - 1;
+	}
+
+	// Returns a register holding the value of expression, which is the
+	// variable's own register for a simple variable.
+	int compileOperand(Expression* expression) {
+		int reg = variableRegister(expression);
+		if (reg >= 0)
+			return reg;
+		reg = allocateRegister();
+		compileInto(expression, reg);
+		return reg;
+	}
+
+	void compileInto(Expression* expression, int target) {
+		switch (expression->type) {
+		case LITERAL:
+			out->constants.push_back(((Literal*)expression)->data);
+			emit(VM_LOAD_CONST, target, out->constants.size() - 1);
+			break;
+		case VARIABLE: {
+			int reg = variableRegister(expression);
+			if (reg >= 0) {
+				if (reg != target)
+					emit(VM_MOVE, target, reg);
+			}
+			else {
+				emit(VM_LOAD_MEMBER, target, memberIndex(&((Variable*)expression)->members));
+			}
+			break;
+		}
+		case OPERATOR: {
+			Operator* op = (Operator*)expression;
+			int mark = nextRegister;
+			int left = compileOperand(op->left);
+			int right = compileOperand(op->right);
+			if (op->kind == OP_UNKNOWN) {
+				out->names.push_back(op->op);
+				emit(VM_INVALID_OP, out->names.size() - 1, left, right);
+			}
+			else {
+				emit((Opcode)(VM_ADD + (int)op->kind), target, left, right);
+			}
+			nextRegister = mark;
+			break;
+		}
+		case FUNCTION_CALL: {
+			FunctionCall* call = (FunctionCall*)expression;
+			int mark = nextRegister;
+			int first = nextRegister;
+			for (size_t i = 0; i < call->params.size(); i++)
+				allocateRegister();
+			for (size_t i = 0; i < call->params.size(); i++)
+				compileInto(call->params[i], first + i);
+			out->calls.push_back({ dynamic_cast<Function*>(call->callee), call->callee, (int)call->params.size(), call });
+			emit(VM_CALL, target, out->calls.size() - 1, first);
+			nextRegister = mark;
+			break;
+		}
+		case RETURN_BLOCK:
+			compileEffect(expression);
+			break;
+		case STATEMENT_WRAPPER:
+			compileStatement(((StatementWrapper*)expression)->statement);
+			out->constants.push_back(Data());
+			emit(VM_LOAD_CONST, target, out->constants.size() - 1);
+			break;
+		default:
+			cerr << "Error: cannot compile expression node " << expression->type << endl;
+			exit(1);
+		}
+	}
+
+	// Compiles an expression whose value is not used.
+	void compileEffect(Expression* expression) {
+		int mark = nextRegister;
+		if (expression->type == RETURN_BLOCK)
+			emit(VM_RETURN, compileOperand(((Return*)expression)->expression));
+		else if (expression->type == STATEMENT_WRAPPER)
+			compileStatement(((StatementWrapper*)expression)->statement);
+		else if (variableRegister(expression) < 0)
+			compileInto(expression, allocateRegister());
+		nextRegister = mark;
+	}
+
+	void compileStatement(Statement* statement) {
+		int mark = nextRegister;
+		switch (statement->type) {
+		case BLOCK:
+			for (Statement* child : ((Block*)statement)->statements)
+				compileStatement(child);
+			break;
+		case ASSIGNMENT: {
+			Assignment* assignment = (Assignment*)statement;
+			int value = compileOperand(assignment->expression);
+			if (assignment->identifier.members.size() == 1)
+				emit(VM_STORE, assignment->identifier.slot, value);
+			else
+				emit(VM_STORE_MEMBER, memberIndex(&assignment->identifier), value);
+			break;
+		}
+		case DECLARATION: {
+			Declaration* decleration = (Declaration*)statement;
+			emit(VM_DECLARE, decleration->slot, decleration->type);
+			break;
+		}
+		case IF_STATEMENT: {
+			IfStatement* ifStatement = (IfStatement*)statement;
+			int skipIf = emit(VM_JUMP_IF_FALSE, compileOperand(ifStatement->condition), 0, 0);
+			nextRegister = mark;
+			compileStatement(ifStatement->ifBlock);
+			if (ifStatement->elseBlock != nullptr) {
+				int skipElse = emit(VM_JUMP);
+				patchJump(skipIf, here());
+				compileStatement(ifStatement->elseBlock);
+				patchJump(skipElse, here());
+			}
+			else {
+				patchJump(skipIf, here());
+			}
+			break;
+		}
+		case WHILE_STATEMENT: {
+			WhileStatement* whileStatement = (WhileStatement*)statement;
+			int top = here();
+			int exit = emit(VM_JUMP_IF_FALSE, compileOperand(whileStatement->condition), 0, 1);
+			nextRegister = mark;
+			compileStatement(whileStatement->block);
+			emit(VM_JUMP, 0, top);
+			patchJump(exit, here());
+			break;
+		}
+		case EXPR_WRAPPER:
+			compileEffect(((ExpressionWrapper*)statement)->expression);
+			break;
+		default:
+			cerr << "Error: cannot compile statement node " << statement->type << endl;
+			exit(1);
+		}
+		nextRegister = mark;
+	}
+
+public:
+	BytecodeFunction* compile(Function* function) {
+		this->function = function;
+		if (function->block == nullptr)
+			function->parseBody();
+		out = new BytecodeFunction();
+		nextRegister = function->frameSize;
+		out->registerCount = function->frameSize;
+		for (Expression* expression : function->block->expressions)
+			compileEffect(expression);
+		emit(VM_RETURN_NULL);
+		return out;
+	}
+};
+
+Data vmRun(BytecodeFunction* function);
+
+// Calls function with argumentCount arguments that start at index arguments of
+// valueStack. The frame is pushed above them, so they are copied by index:
+// growing the stack may move it.
+Data vmCall(Function* function, size_t arguments, int argumentCount) {
+	if (function->bytecode == nullptr)
+		function->bytecode = BytecodeCompiler().compile(function);
+	BytecodeFunction* bytecode = function->bytecode;
+	size_t base = valueStack.size();
+	valueStack.resize(base + bytecode->registerCount);
+	for (int i = 0; i < argumentCount; i++)
+		valueStack[base + i] = valueStack[arguments + i];
+	size_t callerBase = frameBase;
+	frameBase = base;
+	Data result = vmRun(bytecode);
+	frameBase = callerBase;
+	valueStack.resize(base);
+	return result;
+}
+
+// Runs a script function from outside the VM, such as main.
+Data vmCallFunction(Function* function, DataSpan args) {
+	size_t arguments = valueStack.size();
+	valueStack.insert(valueStack.end(), args.begin(), args.end());
+	Data result = vmCall(function, arguments, args.size());
+	valueStack.resize(arguments);
+	return result;
+}
+
+void vmTypeError(const char* statement, Data condition) {
+	cerr << "Error: expected bool in " << statement << " statement condition but got " << condition.type << endl;
+	exit(1);
+}
+
+// GCC and Clang dispatch through a table of label addresses (computed goto),
+// which gives every instruction its own indirect branch. Other compilers use
+// the switch.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_DISPATCH() goto *dispatchTable[ip->opcode]
+#define VM_CASE(name) label_##name
+#else
+#define VM_DISPATCH() goto dispatch
+#define VM_CASE(name) case name
+#endif
+
+#define VM_NEXT() \
+	ip++; \
+	VM_DISPATCH()
+
+// Int operands take the inline path; anything else goes through
+// applyOperator, which handles the other types and reports type errors.
+#define VM_INT_OPERATOR(name, kind, result) \
+	VM_CASE(name): { \
+		Data left = r[ip->b]; \
+		Data right = r[ip->c]; \
+		if (left.type == INT && right.type == INT) { \
+			int x = left.intValue; \
+			int y = right.intValue; \
+			r[ip->a] = result; \
+		} \
+		else { \
+			r[ip->a] = applyOperator(kind, operatorSpellings[kind], left, right); \
+		} \
+		VM_NEXT(); \
+	}
+
+Data vmRun(BytecodeFunction* function) {
+	const Instruction* ip = function->code.data();
+	Data* r = &valueStack[frameBase];
+#ifdef VM_COMPUTED_GOTO
+#define VM_LABEL(name) &&label_##name,
+	static void* dispatchTable[] = { VM_OPCODES(VM_LABEL) };
+#undef VM_LABEL
+	VM_DISPATCH();
+#else
+dispatch:
+	switch (ip->opcode) {
+#endif
+	VM_CASE(VM_LOAD_CONST): {
+		r[ip->a] = function->constants[ip->b];
+		VM_NEXT();
+	}
+	VM_CASE(VM_MOVE): {
+		r[ip->a] = r[ip->b];
+		VM_NEXT();
+	}
+	VM_CASE(VM_STORE): {
+		if (r[ip->a].type != r[ip->b].type) {
+			cerr << "Assignment::Execute Error: expected type " << r[ip->a].type << " but got " << r[ip->b].type << endl;
+			exit(1);
+		}
+		r[ip->a] = r[ip->b];
+		VM_NEXT();
+	}
+	VM_CASE(VM_DECLARE): {
+		Data value = createDataFromType((DataType)ip->b);
+		r[ip->a] = value;
+		VM_NEXT();
+	}
+	VM_CASE(VM_LOAD_MEMBER): {
+		r[ip->a] = *function->members[ip->b]->get();
+		VM_NEXT();
+	}
+	VM_CASE(VM_STORE_MEMBER): {
+		Data* member = function->members[ip->a]->get();
+		if (member->type != r[ip->b].type) {
+			cerr << "Assignment::Execute Error: expected type " << member->type << " but got " << r[ip->b].type << endl;
+			exit(1);
+		}
+		*member = r[ip->b];
+		VM_NEXT();
+	}
+	VM_INT_OPERATOR(VM_ADD, OP_ADD, makeInt(x + y))
+	VM_INT_OPERATOR(VM_SUBTRACT, OP_SUBTRACT, makeInt(x - y))
+	VM_INT_OPERATOR(VM_MULTIPLY, OP_MULTIPLY, makeInt(x * y))
+	VM_INT_OPERATOR(VM_DIVIDE, OP_DIVIDE, makeInt(x / y))
+	VM_INT_OPERATOR(VM_GREATER, OP_GREATER, makeBool(x > y))
+	VM_INT_OPERATOR(VM_LESS, OP_LESS, makeBool(x < y))
+	VM_INT_OPERATOR(VM_EQUAL, OP_EQUAL, makeBool(x == y))
+	VM_INT_OPERATOR(VM_NOT_EQUAL, OP_NOT_EQUAL, makeBool(x != y))
+	VM_CASE(VM_AND): {
+		r[ip->a] = applyOperator(OP_AND, operatorSpellings[OP_AND], r[ip->b], r[ip->c]);
+		VM_NEXT();
+	}
+	VM_CASE(VM_OR): {
+		r[ip->a] = applyOperator(OP_OR, operatorSpellings[OP_OR], r[ip->b], r[ip->c]);
+		VM_NEXT();
+	}
+	VM_CASE(VM_INVALID_OP): {
+		applyOperator(OP_UNKNOWN, function->names[ip->a], r[ip->b], r[ip->c]);
+		VM_NEXT();
+	}
+	VM_CASE(VM_JUMP): {
+		ip = function->code.data() + ip->b;
+		VM_DISPATCH();
+	}
+	VM_CASE(VM_JUMP_IF_FALSE): {
+		Data condition = r[ip->a];
+		if (condition.type != BOOL)
+			vmTypeError(ip->c ? "while" : "if", condition);
+		if (condition.boolValue) {
+			VM_NEXT();
+		}
+		ip = function->code.data() + ip->b;
+		VM_DISPATCH();
+	}
+	VM_CASE(VM_CALL): {
+		const CallSite& site = function->calls[ip->b];
+		size_t arguments = frameBase + ip->c;
+		if (site.call->checkedParams != nullptr)
+			site.call->checkArguments(DataSpan(valueStack.data() + arguments, site.argumentCount));
+		Data result;
+		if (site.function != nullptr) {
+			result = vmCall(site.function, arguments, site.argumentCount);
+		}
+		else {
+			// Only builtins get here, and they do not touch the value stack.
+			site.callable->call(DataSpan(valueStack.data() + arguments, site.argumentCount), result);
+		}
+		// The call may have grown the value stack.
+		r = &valueStack[frameBase];
+		r[ip->a] = result;
+		VM_NEXT();
+	}
+	VM_CASE(VM_RETURN): {
+		return r[ip->a];
+	}
+	VM_CASE(VM_RETURN_NULL): {
+		return Data();
+	}
+#ifndef VM_COMPUTED_GOTO
+	}
+	return Data();
+#endif
+}
+
+#undef VM_INT_OPERATOR
+#undef VM_NEXT
+#undef VM_CASE
+#undef VM_DISPATCH